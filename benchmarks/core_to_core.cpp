@@ -0,0 +1,233 @@
+/**
+ * @file core_to_core.cpp
+ * @brief Core-to-core latency matrix: for every pair of CPUs, two threads
+ * pinned with the affinity property bounce a cache line back and forth, the
+ * mean round trip is the cost of handing data between the two cores.
+ *
+ * The CSV export is the input of topology::readLatencyMatrix, which ranks the
+ * close cores of a CPU for placement decisions.
+ *
+ * Usage: OSCompatible_bench_core_to_core [options]
+ *   --cpus <list>      CPUs to measure (default: the online CPUs)
+ *   --rounds <n>       Round trips per pair (default 20000)
+ *   --csv <path>       Writes the matrix as CSV (round trip ns)
+ */
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+#include "OSCompatible.h"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+// The bounced cache line, alone on its line so only the two threads touch it
+struct alignas(64) Line
+{
+    std::atomic<uint64_t> value{0};
+};
+
+
+static std::vector<bool> pinned(size_t cpu)
+{
+    std::vector<bool> affinity(cpu + 1, false);
+    affinity[cpu] = true;
+    return affinity;
+}
+
+
+// Spawns a thread pinned on the CPU and reads back the affinity the kernel
+// applied, the measurements are meaningless with unpinned threads
+static bool pinningApplied(size_t cpu)
+{
+    std::vector<bool> effective;
+    OSCompatible::thread::Properties properties = OSCompatible::thread::DEFAULT_PROPERTIES;
+    properties.affinity = pinned(cpu);
+
+    OSCompatible::thread probe(properties, [&effective]()
+    {
+        effective = OSCompatible::registry::effective(OSCompatible::registry::currentTid()).affinity;
+    });
+    probe.join();
+
+    // Windows reports no effective affinity, nothing to compare with
+    return effective.empty() || (OSCompatible::cpulist::count(effective) == 1 && cpu < effective.size() && effective[cpu]);
+}
+
+
+// Odd values are pings written by the first thread, even values the pongs of the second
+static void pong(Line* line, uint64_t rounds)
+{
+    for (uint64_t round = 1; round <= rounds; ++round)
+    {
+        while (line->value.load(std::memory_order_acquire) != 2 * round - 1)
+        { }
+        line->value.store(2 * round, std::memory_order_release);
+    }
+}
+
+
+static void ping(Line* line, uint64_t rounds, double* roundTripNs)
+{
+    const auto begin = Clock::now();
+    for (uint64_t round = 1; round <= rounds; ++round)
+    {
+        line->value.store(2 * round - 1, std::memory_order_release);
+        while (line->value.load(std::memory_order_acquire) != 2 * round)
+        { }
+    }
+    *roundTripNs = std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / rounds;
+}
+
+
+// Mean round trip between two CPUs, the best of a few runs to filter out preemptions
+static double measure(size_t first, size_t second, uint64_t rounds)
+{
+    double best = 0;
+    for (int run = 0; run < 3; ++run)
+    {
+        Line line;
+        double roundTripNs = 0;
+
+        OSCompatible::thread::Properties pongProperties = OSCompatible::thread::DEFAULT_PROPERTIES;
+        pongProperties.affinity = pinned(second);
+        OSCompatible::thread::Properties pingProperties = OSCompatible::thread::DEFAULT_PROPERTIES;
+        pingProperties.affinity = pinned(first);
+
+        OSCompatible::thread responder(pongProperties, pong, &line, rounds);
+        OSCompatible::thread requester(pingProperties, ping, &line, rounds, &roundTripNs);
+        requester.join();
+        responder.join();
+
+        best = run == 0 ? roundTripNs : std::min(best, roundTripNs);
+    }
+    return best;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<bool> cpus = OSCompatible::topology::onlineCpus();
+    uint64_t rounds = 20000;
+    std::string csv;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+
+        if (option == "--cpus")         cpus = OSCompatible::cpulist::parse(value);
+        else if (option == "--rounds")  rounds = std::stoull(value);
+        else if (option == "--csv")     csv = value;
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<size_t> ids;
+    for (size_t cpu = 0; cpu < cpus.size(); ++cpu)
+    {
+        if (cpus[cpu])
+        {
+            ids.push_back(cpu);
+        }
+    }
+
+    if (ids.size() < 2)
+    {
+        std::cerr << "need at least 2 CPUs, have " << ids.size() << std::endl;
+        return 1;
+    }
+
+    if (!pinningApplied(ids[0]))
+    {
+        std::cerr << "affinity of CPU " << ids[0] << " was not applied, the threads would run unpinned" << std::endl;
+        return 1;
+    }
+
+    // Spinning on both sides of a pair sharing one CPU would only measure time slices
+    std::vector<std::vector<double>> latency(ids.size(), std::vector<double>(ids.size(), -1.0));
+
+    try
+    {
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            for (size_t j = i + 1; j < ids.size(); ++j)
+            {
+                latency[i][j] = latency[j][i] = measure(ids[i], ids[j], rounds);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "core-to-core round trip (ns), " << rounds << " rounds per pair" << std::endl;
+    std::cout << std::setw(6) << "cpu";
+    for (size_t id : ids)
+    {
+        std::cout << std::setw(8) << id;
+    }
+    std::cout << std::endl;
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        std::cout << std::setw(6) << ids[i] << std::fixed << std::setprecision(0);
+        for (size_t j = 0; j < ids.size(); ++j)
+        {
+            if (latency[i][j] < 0)
+            {
+                std::cout << std::setw(8) << "-";
+            }
+            else
+            {
+                std::cout << std::setw(8) << latency[i][j];
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    if (!csv.empty())
+    {
+        std::ofstream file(csv);
+        if (!file)
+        {
+            std::cerr << "failed to open " << csv << std::endl;
+            return 1;
+        }
+
+        file << "cpu";
+        for (size_t id : ids)
+        {
+            file << "," << id;
+        }
+        file << "\n";
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            file << ids[i];
+            for (size_t j = 0; j < ids.size(); ++j)
+            {
+                file << ",";
+                if (latency[i][j] >= 0)
+                {
+                    file << latency[i][j];
+                }
+            }
+            file << "\n";
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * @file cyclictest.cpp
+ * @brief cyclictest-style wakeup latency benchmark: one periodic measurement
+ * thread per selected CPU, created with the given properties, optionally under
+ * synthetic load, to validate the real-time readiness of a host through the
+ * same code paths the services use.
+ *
+ * Usage: OSCompatible_bench_cyclictest [options]
+ *   --cpus <list>          CPUs to measure on (default: the online CPUs)
+ *   --properties "<def>"   Properties of the measurement threads, in the
+ *                          profile syntax (e.g. "policy=fifo priority=80")
+ *   --interval <us>        Wakeup period (default 1000)
+ *   --duration <s>         Run time (default 10)
+ *   --spin <us>            Spin over the last microseconds of each period (default 0)
+ *   --load <n>             Spinning load threads per measured CPU (default 0)
+ *   --load-properties "<def>"  Properties of the load threads
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+#include "OSCompatible.h"
+
+
+static void spin(std::atomic<bool>* stop)
+{
+    volatile unsigned long counter = 0;
+    while (!stop->load(std::memory_order_relaxed))
+    {
+        counter = counter + 1;
+    }
+}
+
+
+// Spawns a thread with the one-CPU mask and reads back the affinity the kernel
+// applied, a per-CPU row is meaningless with unpinned threads
+static bool pinningApplied(const std::vector<bool>& affinity, size_t cpu)
+{
+    std::vector<bool> effective;
+    OSCompatible::thread::Properties properties = OSCompatible::thread::DEFAULT_PROPERTIES;
+    properties.affinity = affinity;
+
+    OSCompatible::thread probe(properties, [&effective]()
+    {
+        effective = OSCompatible::registry::effective(OSCompatible::registry::currentTid()).affinity;
+    });
+    probe.join();
+
+    // Windows reports no effective affinity, nothing to compare with
+    return effective.empty() || (OSCompatible::cpulist::count(effective) == 1 && cpu < effective.size() && effective[cpu]);
+}
+
+
+static void printRow(const std::string& name, const OSCompatible::histogram& latency)
+{
+    std::cout << std::left << std::setw(8) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << latency.count()
+              << std::setw(10) << latency.min() / 1000.0
+              << std::setw(10) << latency.mean() / 1000.0
+              << std::setw(10) << latency.percentile(99.0) / 1000.0
+              << std::setw(10) << latency.percentile(99.9) / 1000.0
+              << std::setw(10) << latency.max() / 1000.0 << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<bool> cpus = OSCompatible::topology::onlineCpus();
+    std::string properties;
+    std::string loadProperties;
+    long interval = 1000;
+    long duration = 10;
+    long spinUs = 0;
+    long load = 0;
+
+    try
+    {
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            std::string option = argv[i];
+            std::string value = argv[i + 1];
+
+            if (option == "--cpus")                 cpus = OSCompatible::cpulist::parse(value);
+            else if (option == "--properties")      properties = value;
+            else if (option == "--interval")        interval = std::stol(value);
+            else if (option == "--duration")        duration = std::stol(value);
+            else if (option == "--spin")            spinUs = std::stol(value);
+            else if (option == "--load")            load = std::stol(value);
+            else if (option == "--load-properties") loadProperties = value;
+            else
+            {
+                std::cerr << "unknown option " << option << std::endl;
+                return 1;
+            }
+        }
+
+        OSCompatible::thread::Properties measure = OSCompatible::profile::parseProperties(properties);
+        OSCompatible::thread::Properties loadProps = OSCompatible::profile::parseProperties(loadProperties);
+
+        OSCompatible::periodic_thread::Options options;
+        options.spin = std::chrono::microseconds(spinUs);
+
+        std::atomic<bool> stop(false);
+        std::vector<std::unique_ptr<OSCompatible::thread>> loaders;
+
+        // Stops and joins the load threads on every exit, a failed spawn
+        // included: they read stop until then
+        struct LoadersGuard
+        {
+            std::atomic<bool>& stop;
+            std::vector<std::unique_ptr<OSCompatible::thread>>& loaders;
+
+            ~LoadersGuard()
+            {
+                stop = true;
+                for (auto& loader : loaders)
+                {
+                    if (loader->joinable())
+                    {
+                        loader->join();
+                    }
+                }
+            }
+        } loadersGuard{stop, loaders};
+
+        std::vector<std::unique_ptr<OSCompatible::periodic_thread>> measurers;
+        std::vector<std::string> names;
+
+        for (size_t cpu = 0; cpu < cpus.size(); ++cpu)
+        {
+            if (!cpus[cpu])
+            {
+                continue;
+            }
+
+            std::vector<bool> affinity(cpu + 1, false);
+            affinity[cpu] = true;
+            if (!pinningApplied(affinity, cpu))
+            {
+                throw std::runtime_error("affinity of CPU " + std::to_string(cpu) + " was not applied, the threads would run unpinned");
+            }
+
+            for (long i = 0; i < load; ++i)
+            {
+                OSCompatible::thread::Properties p = loadProps;
+                p.affinity = affinity;
+                loaders.push_back(std::make_unique<OSCompatible::thread>(p, spin, &stop));
+            }
+
+            OSCompatible::thread::Properties p = measure;
+            p.affinity = affinity;
+            if (p.name.empty())
+            {
+                p.name = "cyclic" + std::to_string(cpu);
+            }
+            measurers.push_back(std::make_unique<OSCompatible::periodic_thread>(
+                p, std::chrono::microseconds(interval), []() {}, options));
+            names.push_back(std::to_string(cpu));
+        }
+
+        std::cout << "wakeup latency, " << measurers.size() << " CPUs, interval " << interval << "us, "
+                  << duration << "s, " << load << " load threads per CPU"
+                  << (properties.empty() ? "" : ", properties \"" + properties + "\"") << std::endl;
+
+        std::this_thread::sleep_for(std::chrono::seconds(duration));
+
+        for (auto& measurer : measurers)
+        {
+            measurer->stop();
+        }
+        stop = true;
+        for (auto& loader : loaders)
+        {
+            loader->join();
+        }
+
+        std::cout << std::left << std::setw(8) << "cpu"
+                  << std::right << std::setw(10) << "samples"
+                  << std::setw(10) << "min(us)"
+                  << std::setw(10) << "avg(us)"
+                  << std::setw(10) << "p99(us)"
+                  << std::setw(10) << "p99.9(us)"
+                  << std::setw(10) << "max(us)" << std::endl;
+
+        OSCompatible::histogram total;
+        for (size_t i = 0; i < measurers.size(); ++i)
+        {
+            printRow(names[i], measurers[i]->latency());
+            total.merge(measurers[i]->latency());
+        }
+        printRow("all", total);
+
+        uint64_t overruns = 0;
+        for (auto& measurer : measurers)
+        {
+            overruns += measurer->overruns();
+        }
+        std::cout << overruns << " overruns" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
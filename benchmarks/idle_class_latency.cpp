@@ -0,0 +1,127 @@
+/**
+ * @file idle_class_latency.cpp
+ * @brief Measures the wakeup latency of a foreground thread while background
+ * threads saturate all the CPU cores with different scheduling classes.
+ *
+ * Usage: OSCompatible_bench_idle_class_latency [samples] [period_us]
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "OSCompatible.h"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+struct Result
+{
+    double meanUs;
+    double p99Us;
+    double maxUs;
+};
+
+
+// Sleeps until the next period and records how late the thread woke up
+static Result measureForeground(size_t samples, std::chrono::microseconds period)
+{
+    std::vector<double> latencies;
+    latencies.reserve(samples);
+
+    auto next = Clock::now() + period;
+    for (size_t i = 0; i < samples; ++i)
+    {
+        std::this_thread::sleep_until(next);
+        auto late = std::chrono::duration<double, std::micro>(Clock::now() - next).count();
+        latencies.push_back(late);
+        next += period;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    double sum = 0;
+    for (double l : latencies)
+    {
+        sum += l;
+    }
+
+    return { sum / latencies.size(), latencies[latencies.size() * 99 / 100], latencies.back() };
+}
+
+
+static void spin(std::atomic<bool>* stop)
+{
+    volatile unsigned long counter = 0;
+    while (!stop->load(std::memory_order_relaxed))
+    {
+        counter = counter + 1;
+    }
+}
+
+
+static void runScenario(const std::string& name, const OSCompatible::thread::Properties* background,
+                        size_t samples, std::chrono::microseconds period)
+{
+    std::atomic<bool> stop(false);
+    std::vector<OSCompatible::thread*> spinners;
+
+    if (background != nullptr)
+    {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < cores; ++i)
+        {
+            spinners.push_back(new OSCompatible::thread(*background, spin, &stop));
+        }
+    }
+
+    OSCompatible::thread foreground(measureForeground, samples, period);
+    foreground.join();
+    Result result = std::any_cast<Result>(foreground.getResult());
+
+    stop = true;
+    for (auto* spinner : spinners)
+    {
+        spinner->join();
+        delete spinner;
+    }
+
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << result.meanUs
+              << std::setw(12) << result.p99Us
+              << std::setw(12) << result.maxUs << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t samples = argc > 1 ? std::stoul(argv[1]) : 2000;
+    std::chrono::microseconds period(argc > 2 ? std::stol(argv[2]) : 1000);
+
+    std::cout << "foreground wakeup latency, " << samples << " samples, period "
+              << period.count() << "us, background spinners on all "
+              << std::thread::hardware_concurrency() << " cores" << std::endl;
+    std::cout << std::left << std::setw(28) << "background"
+              << std::right << std::setw(12) << "mean(us)"
+              << std::setw(12) << "p99(us)"
+              << std::setw(12) << "max(us)" << std::endl;
+
+    OSCompatible::thread::Properties normal = OSCompatible::thread::DEFAULT_PROPERTIES;
+    OSCompatible::thread::Properties batch = OSCompatible::thread::BackgroundProperties(OSCompatible::thread::BATCH_POLICY);
+    OSCompatible::thread::Properties batchNice = OSCompatible::thread::BackgroundProperties(OSCompatible::thread::BATCH_POLICY, 19);
+    OSCompatible::thread::Properties idle = OSCompatible::thread::BackgroundProperties(OSCompatible::thread::IDLE_POLICY);
+
+    runScenario("none", nullptr, samples, period);
+    runScenario("default", &normal, samples, period);
+    runScenario("SCHED_BATCH", &batch, samples, period);
+    runScenario("SCHED_BATCH nice 19", &batchNice, samples, period);
+    runScenario("SCHED_IDLE", &idle, samples, period);
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file lock_contention.cpp
+ * @brief Contention benchmark of spin_mutex against std::mutex, and of
+ * futex_condition against std::condition_variable, from 2 to 128 threads.
+ *
+ * mutex:     every thread increments shared counters under the lock, then
+ *            does some work outside of it; reports the lock acquisitions per
+ *            second and the fairness (least over most acquisitions of a thread).
+ * condition: one producer feeds a bounded queue, the other threads consume
+ *            it, both sides wait on a condition when the queue is full/empty;
+ *            reports the items per second.
+ *
+ * Usage: OSCompatible_bench_lock_contention [options]
+ *   --max-threads <n>  Largest thread count, doubled from 2 (default 128)
+ *   --duration <ms>    Run time of each measurement (default 300)
+ *   --inside <n>       Counter increments under the lock (default 4)
+ *   --outside <n>      Loop iterations between two acquisitions (default 100)
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+
+#include "OSCompatible.h"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+struct Options
+{
+    size_t maxThreads = 128;
+    std::chrono::milliseconds duration{300};
+    size_t inside = 4;
+    size_t outside = 100;
+};
+
+
+template <typename Mutex>
+static void mutexRun(const std::string& name, size_t threads, const Options& options)
+{
+    Mutex mutex;
+    volatile uint64_t counters[8] = {0};
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> acquisitions(threads, 0);
+    std::vector<std::unique_ptr<OSCompatible::thread>> workers;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.push_back(std::make_unique<OSCompatible::thread>([&, i]()
+        {
+            uint64_t count = 0;
+            volatile uint64_t local = 0;
+
+            while (!start.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                {
+                    std::lock_guard<Mutex> lock(mutex);
+                    for (size_t n = 0; n < options.inside; ++n)
+                    {
+                        counters[n % 8] = counters[n % 8] + 1;
+                    }
+                }
+                ++count;
+
+                for (size_t n = 0; n < options.outside; ++n)
+                {
+                    local = local + 1;
+                }
+            }
+            acquisitions[i] = count;
+        }));
+    }
+
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(options.duration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& worker : workers)
+    {
+        worker->join();
+    }
+
+    uint64_t total = 0;
+    for (uint64_t count : acquisitions)
+    {
+        total += count;
+    }
+    const auto bounds = std::minmax_element(acquisitions.begin(), acquisitions.end());
+    const double seconds = std::chrono::duration<double>(options.duration).count();
+
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::setw(8) << threads
+              << std::fixed << std::setprecision(2)
+              << std::setw(14) << total / seconds / 1e6
+              << std::setw(12) << (*bounds.second == 0 ? 0.0 : static_cast<double>(*bounds.first) / *bounds.second)
+              << std::endl;
+}
+
+
+template <typename Mutex, typename Condition>
+static void conditionRun(const std::string& name, size_t threads, const Options& options)
+{
+    constexpr size_t CAPACITY = 64;
+
+    Mutex mutex;
+    Condition notEmpty;
+    Condition notFull;
+    std::deque<uint64_t> queue;
+    bool stop = false;
+    std::atomic<uint64_t> consumed(0);
+    std::vector<std::unique_ptr<OSCompatible::thread>> workers;
+
+    // One producer, the other threads consume
+    for (size_t i = 1; i < threads; ++i)
+    {
+        workers.push_back(std::make_unique<OSCompatible::thread>([&]()
+        {
+            uint64_t count = 0;
+            for (;;)
+            {
+                std::unique_lock<Mutex> lock(mutex);
+                notEmpty.wait(lock, [&]() { return stop || !queue.empty(); });
+                if (queue.empty())
+                {
+                    break;
+                }
+                queue.pop_front();
+                lock.unlock();
+
+                notFull.notify_one();
+                ++count;
+            }
+            consumed.fetch_add(count, std::memory_order_relaxed);
+        }));
+    }
+
+    OSCompatible::thread producer([&]()
+    {
+        const auto end = Clock::now() + options.duration;
+        uint64_t item = 0;
+        while (Clock::now() < end)
+        {
+            {
+                std::unique_lock<Mutex> lock(mutex);
+                notFull.wait(lock, [&]() { return queue.size() < CAPACITY; });
+                queue.push_back(item++);
+            }
+            notEmpty.notify_one();
+        }
+
+        {
+            std::lock_guard<Mutex> lock(mutex);
+            stop = true;
+        }
+        notEmpty.notify_all();
+    });
+
+    producer.join();
+    for (auto& worker : workers)
+    {
+        worker->join();
+    }
+
+    const double seconds = std::chrono::duration<double>(options.duration).count();
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::setw(8) << threads
+              << std::fixed << std::setprecision(2)
+              << std::setw(14) << consumed.load() / seconds / 1e6 << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+
+        if (option == "--max-threads")      options.maxThreads = std::stoul(value);
+        else if (option == "--duration")    options.duration = std::chrono::milliseconds(std::stol(value));
+        else if (option == "--inside")      options.inside = std::stoul(value);
+        else if (option == "--outside")     options.outside = std::stoul(value);
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "mutex, " << options.inside << " increments inside, " << options.outside << " iterations outside" << std::endl;
+    std::cout << std::left << std::setw(28) << "lock"
+              << std::right << std::setw(8) << "threads"
+              << std::setw(14) << "Macq/s"
+              << std::setw(12) << "fairness" << std::endl;
+
+    for (size_t threads = 2; threads <= options.maxThreads; threads *= 2)
+    {
+        mutexRun<std::mutex>("std::mutex", threads, options);
+        mutexRun<OSCompatible::spin_mutex>("OSCompatible::spin_mutex", threads, options);
+    }
+
+    std::cout << std::endl << "condition, 1 producer, bounded queue" << std::endl;
+    std::cout << std::left << std::setw(28) << "condition"
+              << std::right << std::setw(8) << "threads"
+              << std::setw(14) << "Mitems/s" << std::endl;
+
+    for (size_t threads = 2; threads <= options.maxThreads; threads *= 2)
+    {
+        conditionRun<std::mutex, std::condition_variable>("std::condition_variable", threads, options);
+        conditionRun<OSCompatible::spin_mutex, OSCompatible::futex_condition>("OSCompatible::futex_condition", threads, options);
+    }
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file shared_mutex.cpp
+ * @brief Read-mostly lookup table guarded by std::shared_mutex and by
+ * percpu_shared_mutex, at 95%, 99% and 99.9% reads, one thread per online CPU
+ * pinned with the affinity property.
+ *
+ * Usage: OSCompatible_bench_shared_mutex [options]
+ *   --threads <n>      Threads (default: one per online CPU)
+ *   --duration <ms>    Run time of each measurement (default 500)
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+
+#include "OSCompatible.h"
+
+
+static constexpr size_t TABLE_SIZE = 1024;
+
+
+template <typename Mutex>
+static void run(const std::string& name, const std::vector<size_t>& cpus, double readRatio,
+                std::chrono::milliseconds duration)
+{
+    Mutex mutex;
+    std::vector<uint64_t> table(TABLE_SIZE, 1);
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> operations(0);
+    std::vector<std::unique_ptr<OSCompatible::thread>> workers;
+
+    // Writes when the random draw falls under the threshold
+    const uint64_t writeThreshold = static_cast<uint64_t>((1.0 - readRatio) * 1000000.0);
+
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        OSCompatible::thread::Properties properties = OSCompatible::thread::DEFAULT_PROPERTIES;
+        properties.affinity = std::vector<bool>(cpus[i] + 1, false);
+        properties.affinity[cpus[i]] = true;
+
+        workers.push_back(std::make_unique<OSCompatible::thread>(properties, [&, i]()
+        {
+            uint64_t random = 0x9E3779B97F4A7C15ULL * (i + 1);
+            uint64_t count = 0;
+            uint64_t sum = 0;
+
+            while (!start.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                // xorshift64
+                random ^= random << 13;
+                random ^= random >> 7;
+                random ^= random << 17;
+                const size_t key = random % TABLE_SIZE;
+
+                if ((random >> 20) % 1000000 < writeThreshold)
+                {
+                    std::lock_guard<Mutex> lock(mutex);
+                    table[key] += 1;
+                }
+                else
+                {
+                    std::shared_lock<Mutex> lock(mutex);
+                    sum += table[key];
+                }
+                ++count;
+            }
+
+            volatile uint64_t sink = sum;   // Keeps the reads
+            (void)sink;
+            operations.fetch_add(count, std::memory_order_relaxed);
+        }));
+    }
+
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& worker : workers)
+    {
+        worker->join();
+    }
+
+    const double seconds = std::chrono::duration<double>(duration).count();
+    std::cout << std::left << std::setw(34) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << readRatio * 100.0
+              << std::setprecision(2)
+              << std::setw(14) << operations.load() / seconds / 1e6 << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<bool> online = OSCompatible::topology::onlineCpus();
+    size_t threads = 0;
+    std::chrono::milliseconds duration(500);
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+
+        if (option == "--threads")          threads = std::stoul(value);
+        else if (option == "--duration")    duration = std::chrono::milliseconds(std::stol(value));
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<size_t> onlineIds;
+    for (size_t cpu = 0; cpu < online.size(); ++cpu)
+    {
+        if (online[cpu])
+        {
+            onlineIds.push_back(cpu);
+        }
+    }
+    if (onlineIds.empty())
+    {
+        onlineIds.push_back(0);
+    }
+
+    // Threads beyond the online CPUs wrap around them
+    std::vector<size_t> cpus;
+    for (size_t i = 0; i < (threads != 0 ? threads : onlineIds.size()); ++i)
+    {
+        cpus.push_back(onlineIds[i % onlineIds.size()]);
+    }
+
+    std::cout << "read-mostly table, " << cpus.size() << " threads" << std::endl;
+    std::cout << std::left << std::setw(34) << "lock"
+              << std::right << std::setw(8) << "reads%"
+              << std::setw(14) << "Mops/s" << std::endl;
+
+    for (double readRatio : {0.95, 0.99, 0.999})
+    {
+        run<std::shared_mutex>("std::shared_mutex", cpus, readRatio, duration);
+        run<OSCompatible::percpu_shared_mutex>("OSCompatible::percpu_shared_mutex", cpus, readRatio, duration);
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file spawn_join.cpp
+ * @brief Measures the spawn+join latency, throughput and heap allocations of
+ * the thread constructor paths, so regressions in them become visible.
+ *
+ * The library has no thread pool or executor, every variant creates a new
+ * kernel thread. The profile variant reuses the attributes its profile built
+ * once, the closest thing to pooled creation state.
+ *
+ * Usage: OSCompatible_bench_spawn_join [iterations]
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "OSCompatible.h"
+
+
+// Counts every heap allocation of the process
+static std::atomic<uint64_t> g_allocations(0);
+
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+
+using Clock = std::chrono::steady_clock;
+
+
+static void empty()
+{ }
+
+
+// Spawns a thread with the one-CPU mask and reads back the affinity the kernel
+// applied, the affinity variants measure nothing without it
+static bool pinningApplied(const std::vector<bool>& affinity, size_t cpu)
+{
+    std::vector<bool> effective;
+    OSCompatible::thread::Properties properties = OSCompatible::thread::DEFAULT_PROPERTIES;
+    properties.affinity = affinity;
+
+    OSCompatible::thread probe(properties, [&effective]()
+    {
+        effective = OSCompatible::registry::effective(OSCompatible::registry::currentTid()).affinity;
+    });
+    probe.join();
+
+    // Windows reports no effective affinity, nothing to compare with
+    return effective.empty() || (OSCompatible::cpulist::count(effective) == 1 && cpu < effective.size() && effective[cpu]);
+}
+
+
+// Runs spawnJoin iterations times and prints its latency and allocations
+static void run(const std::string& name, size_t iterations, const std::function<void()>& spawnJoin)
+{
+    try
+    {
+        spawnJoin(); // warm up (and fail early if the variant isn't permitted)
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << std::left << std::setw(30) << name << "unavailable: " << e.what() << std::endl;
+        return;
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+
+    const uint64_t allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+    const auto start = Clock::now();
+
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        const auto begin = Clock::now();
+        spawnJoin();
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+    }
+
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    // The latencies vector was reserved, the allocations are the ones of the spawns
+    const uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (double latency : latencies)
+    {
+        sum += latency;
+    }
+
+    std::cout << std::left << std::setw(30) << name
+              << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << sum / latencies.size()
+              << std::setw(12) << latencies[latencies.size() * 99 / 100]
+              << std::setw(14) << iterations / elapsed
+              << std::setw(12) << static_cast<double>(allocations) / iterations << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 2000;
+
+    std::cout << "spawn+join, " << iterations << " iterations" << std::endl;
+    std::cout << std::left << std::setw(30) << "variant"
+              << std::right << std::setw(12) << "mean(us)"
+              << std::setw(12) << "p99(us)"
+              << std::setw(14) << "threads/s"
+              << std::setw(12) << "allocs" << std::endl;
+
+    run("std::thread", iterations, []()
+    {
+        std::thread t(empty);
+        t.join();
+    });
+
+    run("OSCompatible default", iterations, []()
+    {
+        OSCompatible::thread t(empty);
+        t.join();
+    });
+
+    run("OSCompatible properties", iterations, []()
+    {
+        OSCompatible::thread t(OSCompatible::thread::DEFAULT_PROPERTIES, empty);
+        t.join();
+    });
+
+    // The affinity variants pin on the first online CPU
+    const std::vector<bool> online = OSCompatible::topology::onlineCpus();
+    const size_t cpu = static_cast<size_t>(std::find(online.begin(), online.end(), true) - online.begin());
+    std::vector<bool> firstCpu(cpu + 1, false);
+    firstCpu[cpu] = true;
+    if (!pinningApplied(firstCpu, cpu))
+    {
+        std::cerr << "affinity of CPU " << cpu << " was not applied, the affinity variants would run unpinned" << std::endl;
+        return 1;
+    }
+
+    OSCompatible::thread::Properties affinity = OSCompatible::thread::DEFAULT_PROPERTIES;
+    affinity.affinity = firstCpu;
+    run("OSCompatible affinity cpu" + std::to_string(cpu), iterations, [&affinity]()
+    {
+        OSCompatible::thread t(affinity, empty);
+        t.join();
+    });
+
+    OSCompatible::thread::Properties realtime = OSCompatible::profile::parseProperties("policy=fifo priority=1");
+    run("OSCompatible SCHED_FIFO", iterations, [&realtime]()
+    {
+        OSCompatible::thread t(realtime, empty);
+        t.join();
+    });
+
+    OSCompatible::thread::Properties stack = OSCompatible::thread::DEFAULT_PROPERTIES;
+    stack.stackSize = 64 * 1024;
+    run("OSCompatible stack 64K", iterations, [&stack]()
+    {
+        OSCompatible::thread t(stack, empty);
+        t.join();
+    });
+
+    OSCompatible::thread::Properties named = OSCompatible::thread::DEFAULT_PROPERTIES;
+    named.name = "bench";
+    run("OSCompatible named", iterations, [&named]()
+    {
+        OSCompatible::thread t(named, empty);
+        t.join();
+    });
+
+    OSCompatible::profile::define("bench_spawn", OSCompatible::profile::parseProperties("cpus=" + std::to_string(cpu) + " stack=64K"));
+    run("OSCompatible profile", iterations, []()
+    {
+        OSCompatible::thread t("bench_spawn", empty);
+        t.join();
+    });
+
+    return 0;
+}
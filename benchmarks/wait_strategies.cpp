@@ -0,0 +1,398 @@
+/**
+ * @file wait_strategies.cpp
+ * @brief Handoff latency and CPU burn of the wait strategies between two
+ * OSCompatible threads: futex, condition variable, eventfd, sched_yield
+ * spinning and busy waiting with a pause instruction, for each placement of
+ * the two threads (same core, SMT siblings, another core of the socket,
+ * another socket) under SCHED_OTHER and SCHED_FIFO.
+ *
+ * The two threads bounce a token, the handoff is half a round trip. The CPU
+ * burn is the CPU time of both threads over the wall time, 200% when both
+ * spin all the time.
+ *
+ * Usage: OSCompatible_bench_wait_strategies [options]
+ *   --cpu <n>          First CPU of every placement (default: the first online CPU)
+ *   --rounds <n>       Round trips per run (default 20000)
+ *   --priority <n>     SCHED_FIFO priority (default 50)
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "OSCompatible.h"
+
+
+using Clock = std::chrono::steady_clock;
+
+
+static int64_t threadCpuNs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+}
+
+
+// One direction of the handoff: post(n) publishes the n-th token, wait(n) returns once it is published
+
+struct Futex
+{
+    static constexpr const char* NAME = "futex";
+    static constexpr bool SPINS = false;
+
+    alignas(64) std::atomic<uint32_t> value{0};
+    std::atomic<uint32_t> sleeping{0};
+
+    void post(uint32_t n)
+    {
+        value.store(n, std::memory_order_seq_cst);
+        // The waiter announces itself before re-checking value, so one of the two sides sees the other
+        if (sleeping.load(std::memory_order_seq_cst) != 0)
+        {
+            OSCompatible::futex::wakeOne(value);
+        }
+    }
+
+    void wait(uint32_t n)
+    {
+        uint32_t current;
+        while ((current = value.load(std::memory_order_acquire)) != n)
+        {
+            sleeping.store(1, std::memory_order_seq_cst);
+            if ((current = value.load(std::memory_order_seq_cst)) != n)
+            {
+                OSCompatible::futex::wait(value, current);
+            }
+            sleeping.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+
+struct CondVar
+{
+    static constexpr const char* NAME = "condvar";
+    static constexpr bool SPINS = false;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t value = 0;
+
+    void post(uint32_t n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            value = n;
+        }
+        cv.notify_one();
+    }
+
+    void wait(uint32_t n)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return value == n; });
+    }
+};
+
+
+struct EventFd
+{
+    static constexpr const char* NAME = "eventfd";
+    static constexpr bool SPINS = false;
+
+    int fd = eventfd(0, EFD_CLOEXEC);
+
+    ~EventFd()
+    {
+        close(fd);
+    }
+
+    // Tokens are strictly alternated, one write per read
+    void post(uint32_t)
+    {
+        uint64_t one = 1;
+        while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        { }
+    }
+
+    void wait(uint32_t)
+    {
+        uint64_t count;
+        while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+        { }
+    }
+};
+
+
+struct Yield
+{
+    static constexpr const char* NAME = "sched_yield";
+    static constexpr bool SPINS = false;    // Gives the CPU to the peer on a shared core
+
+    alignas(64) std::atomic<uint32_t> value{0};
+
+    void post(uint32_t n)
+    {
+        value.store(n, std::memory_order_release);
+    }
+
+    void wait(uint32_t n)
+    {
+        while (value.load(std::memory_order_acquire) != n)
+        {
+            sched_yield();
+        }
+    }
+};
+
+
+struct Spin
+{
+    static constexpr const char* NAME = "busy-wait";
+    static constexpr bool SPINS = true;     // Starves the peer on a shared core
+
+    alignas(64) std::atomic<uint32_t> value{0};
+
+    void post(uint32_t n)
+    {
+        value.store(n, std::memory_order_release);
+    }
+
+    void wait(uint32_t n)
+    {
+        while (value.load(std::memory_order_acquire) != n)
+        {
+            OSCompatible::idle::pause();
+        }
+    }
+};
+
+
+struct Placement
+{
+    std::string name;
+    size_t first;
+    size_t second;
+};
+
+
+struct Result
+{
+    double meanNs;      // One-way handoff
+    double p99Ns;
+    double cpuPercent;
+};
+
+
+static std::vector<bool> pinned(size_t cpu)
+{
+    std::vector<bool> affinity(cpu + 1, false);
+    affinity[cpu] = true;
+    return affinity;
+}
+
+
+// Spawns a thread pinned on the CPU and reads back the affinity the kernel
+// applied, the placements are meaningless with unpinned threads
+static bool pinningApplied(size_t cpu)
+{
+    std::vector<bool> effective;
+    OSCompatible::thread::Properties properties = OSCompatible::thread::DEFAULT_PROPERTIES;
+    properties.affinity = pinned(cpu);
+
+    try
+    {
+        OSCompatible::thread probe(properties, [&effective]()
+        {
+            effective = OSCompatible::registry::effective(OSCompatible::registry::currentTid()).affinity;
+        });
+        probe.join();
+    }
+    catch (const std::exception&)
+    {
+        return false; // offline or unknown CPU
+    }
+
+    return OSCompatible::cpulist::count(effective) == 1 && cpu < effective.size() && effective[cpu];
+}
+
+
+template <typename Channel>
+static Result measure(const Placement& placement, const OSCompatible::thread::Properties& policy, uint32_t rounds)
+{
+    Channel toSecond;
+    Channel toFirst;
+    OSCompatible::histogram roundTrips;
+    int64_t firstCpuNs = 0;
+    int64_t secondCpuNs = 0;
+
+    OSCompatible::thread::Properties firstProperties = policy;
+    firstProperties.affinity = pinned(placement.first);
+    OSCompatible::thread::Properties secondProperties = policy;
+    secondProperties.affinity = pinned(placement.second);
+
+    const auto start = Clock::now();
+
+    OSCompatible::thread responder(secondProperties, [&]()
+    {
+        const int64_t cpuStart = threadCpuNs();
+        for (uint32_t round = 1; round <= rounds; ++round)
+        {
+            toSecond.wait(round);
+            toFirst.post(round);
+        }
+        secondCpuNs = threadCpuNs() - cpuStart;
+    });
+
+    OSCompatible::thread requester(firstProperties, [&]()
+    {
+        const int64_t cpuStart = threadCpuNs();
+        for (uint32_t round = 1; round <= rounds; ++round)
+        {
+            const auto begin = Clock::now();
+            toSecond.post(round);
+            toFirst.wait(round);
+            roundTrips.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+        }
+        firstCpuNs = threadCpuNs() - cpuStart;
+    });
+
+    requester.join();
+    responder.join();
+
+    const double wallNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    return {roundTrips.mean() / 2, roundTrips.percentile(99.0) / 2.0, 100.0 * (firstCpuNs + secondCpuNs) / wallNs};
+}
+
+
+template <typename Channel>
+static void run(const Placement& placement, const std::string& policyName,
+                const OSCompatible::thread::Properties& policy, uint32_t rounds)
+{
+    std::cout << std::left << std::setw(14) << placement.name
+              << std::setw(8) << policyName
+              << std::setw(14) << Channel::NAME;
+
+    if (Channel::SPINS && placement.first == placement.second)
+    {
+        std::cout << "skipped: the spinning waiter starves its peer on a shared core" << std::endl;
+        return;
+    }
+
+    try
+    {
+        Result result = measure<Channel>(placement, policy, rounds);
+        std::cout << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(12) << result.meanNs
+                  << std::setw(12) << result.p99Ns
+                  << std::setw(10) << result.cpuPercent << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "unavailable: " << e.what() << std::endl;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<bool> online = OSCompatible::topology::onlineCpus();
+    size_t cpu = 0;
+    while (cpu < online.size() && !online[cpu])
+    {
+        ++cpu;
+    }
+    uint32_t rounds = 20000;
+    std::string priority = "50";
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        std::string value = argv[i + 1];
+
+        if (option == "--cpu")              cpu = std::stoul(value);
+        else if (option == "--rounds")      rounds = static_cast<uint32_t>(std::stoul(value));
+        else if (option == "--priority")    priority = value;
+        else
+        {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    if (!pinningApplied(cpu))
+    {
+        std::cerr << "affinity of CPU " << cpu << " was not applied, the threads would run unpinned" << std::endl;
+        return 1;
+    }
+
+    // The closest CPU of each kind to the first one, placements without one are left out
+    std::vector<Placement> placements = {{"same-core", cpu, cpu}};
+    std::vector<bool> siblings = OSCompatible::topology::siblings(cpu);
+    const int package = OSCompatible::topology::package(cpu);
+    bool smt = false, core = false, socket = false;
+
+    for (size_t other = 0; other < online.size(); ++other)
+    {
+        if (other == cpu || !online[other])
+        {
+            continue;
+        }
+
+        const bool sibling = other < siblings.size() && siblings[other];
+        if (sibling && !smt)
+        {
+            placements.push_back({"smt-sibling", cpu, other});
+            smt = true;
+        }
+        else if (!sibling && OSCompatible::topology::package(other) == package && !core)
+        {
+            placements.push_back({"cross-core", cpu, other});
+            core = true;
+        }
+        else if (OSCompatible::topology::package(other) != package && !socket)
+        {
+            placements.push_back({"cross-socket", cpu, other});
+            socket = true;
+        }
+    }
+
+    const std::vector<std::pair<std::string, OSCompatible::thread::Properties>> policies = {
+        {"other", OSCompatible::profile::parseProperties("policy=other")},
+        {"fifo", OSCompatible::profile::parseProperties("policy=fifo priority=" + priority)},
+    };
+
+    std::cout << "handoff between two threads, " << rounds << " round trips per run" << std::endl;
+    std::cout << std::left << std::setw(14) << "placement"
+              << std::setw(8) << "policy"
+              << std::setw(14) << "strategy"
+              << std::right << std::setw(12) << "mean(ns)"
+              << std::setw(12) << "p99(ns)"
+              << std::setw(10) << "cpu(%)" << std::endl;
+
+    for (const Placement& placement : placements)
+    {
+        for (const auto& policy : policies)
+        {
+            run<Futex>(placement, policy.first, policy.second, rounds);
+            run<CondVar>(placement, policy.first, policy.second, rounds);
+            run<EventFd>(placement, policy.first, policy.second, rounds);
+            run<Yield>(placement, policy.first, policy.second, rounds);
+            run<Spin>(placement, policy.first, policy.second, rounds);
+        }
+    }
+
+    return 0;
+}
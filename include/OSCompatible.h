@@ -13,6 +13,30 @@
 
 
 #include "OSCompatible/thread.hpp"
+#include "OSCompatible/registry.hpp"
+#include "OSCompatible/stats.hpp"
+#include "OSCompatible/perf_counters.hpp"
+#include "OSCompatible/sampler.hpp"
+#include "OSCompatible/tracer.hpp"
+#include "OSCompatible/stats_page.hpp"
+#include "OSCompatible/watchdog.hpp"
+#include "OSCompatible/histogram.hpp"
+#include "OSCompatible/periodic_thread.hpp"
+#include "OSCompatible/futex.hpp"
+#include "OSCompatible/idle_strategy.hpp"
+#include "OSCompatible/worker_thread.hpp"
+#include "OSCompatible/spin_mutex.hpp"
+#include "OSCompatible/futex_condition.hpp"
+#include "OSCompatible/pi_mutex.hpp"
+#include "OSCompatible/percpu_shared_mutex.hpp"
+#include "OSCompatible/seqlock.hpp"
+#include "OSCompatible/rcu.hpp"
+#include "OSCompatible/cpulist.hpp"
+#include "OSCompatible/profile.hpp"
+#include "OSCompatible/cgroup.hpp"
+#include "OSCompatible/topology.hpp"
+#include "OSCompatible/core_allocator.hpp"
+#include "OSCompatible/core_isolation.hpp"
 
 
 namespace OSCompatible
@@ -0,0 +1,322 @@
+/**
+ * @file cgroup.hpp
+ *
+ * @brief Container CPU limits awareness: the effective cpuset and CPU quota of
+ * the process cgroup (v2, with a v1 fallback), affinity restriction to the
+ * usable CPUs, pool size suggestion and quota throttling statistics.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __cgroup__
+#define __cgroup__
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/cpulist.hpp"
+
+
+namespace OSCompatible
+{
+namespace cgroup
+{
+
+
+/**
+ * @brief CPU bandwidth limit of the cgroup (cpu.max, or cpu.cfs_quota_us and
+ * cpu.cfs_period_us on cgroup v1).
+ */
+struct Quota
+{
+    int64_t quotaUs;    // CPU time allowed per period, -1 if unlimited
+    int64_t periodUs;   // Length of the period
+
+    bool limited() const { return quotaUs >= 0 && periodUs > 0; }
+    double cpus() const { return limited() ? static_cast<double>(quotaUs) / static_cast<double>(periodUs) : 0.0; }
+};
+
+
+/**
+ * @brief Quota throttling counters of the cgroup (cpu.stat).
+ */
+struct Throttling
+{
+    uint64_t nrPeriods;     // Enforcement periods elapsed
+    uint64_t nrThrottled;   // Periods in which the cgroup ran out of quota
+    uint64_t throttledUsec; // Total time the cgroup threads were throttled
+};
+
+
+/**
+ * @brief Directory of the process cgroup for the given controller ("cpu",
+ * "cpuset"), the unified (v2) hierarchy is preferred.
+ *
+ * @return The directory, empty if the process cgroup can't be found (or on Windows).
+ */
+inline std::string directory(const std::string& controller)
+{
+#ifdef _WIN32
+    (void)controller;
+    return {};
+#else
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    std::string unified;
+    std::string legacy;
+
+    // Lines are "hierarchy-id:controllers:path", v2 is "0::path"
+    while (std::getline(file, line))
+    {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+        {
+            continue;
+        }
+
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        std::string path = line.substr(second + 1);
+
+        if (controllers.empty())
+        {
+            unified = "/sys/fs/cgroup" + path;
+            continue;
+        }
+
+        std::stringstream names(controllers);
+        std::string name;
+        while (std::getline(names, name, ','))
+        {
+            if (name == controller)
+            {
+                legacy = "/sys/fs/cgroup/" + controllers + path;
+            }
+        }
+    }
+
+    // The unified hierarchy is used only when the controller is enabled there
+    if (!unified.empty())
+    {
+        std::ifstream controllersFile(unified + "/cgroup.controllers");
+        std::string name;
+        while (controllersFile >> name)
+        {
+            if (name == controller)
+            {
+                return unified;
+            }
+        }
+    }
+    return legacy;
+#endif
+}
+
+
+/**
+ * @brief CPUs the process may run on (cpuset.cpus.effective).
+ *
+ * Falls back to the process affinity mask when there is no cpuset controller.
+ */
+inline std::vector<bool> effectiveCpus()
+{
+    std::vector<bool> cpus;
+
+#ifdef _WIN32
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+    {
+        for (size_t i = 0; i < sizeof(DWORD_PTR) * 8; ++i)
+        {
+            cpus.push_back((processMask >> i) & 1);
+        }
+    }
+#else
+    std::string dir = directory("cpuset");
+    if (!dir.empty())
+    {
+        cpus = cpulist::read(dir + "/cpuset.cpus.effective");
+        if (cpus.empty())
+        {
+            cpus = cpulist::read(dir + "/cpuset.effective_cpus"); // cgroup v1
+        }
+    }
+
+    if (cpulist::count(cpus) == 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            cpus.assign(CPU_SETSIZE, false);
+            for (size_t i = 0; i < CPU_SETSIZE; ++i)
+            {
+                cpus[i] = CPU_ISSET(i, &set);
+            }
+            while (!cpus.empty() && !cpus.back())
+            {
+                cpus.pop_back();
+            }
+        }
+    }
+#endif
+
+    return cpus;
+}
+
+
+/**
+ * @brief CPU bandwidth limit of the process cgroup.
+ */
+inline Quota cpuQuota()
+{
+    Quota quota = {-1, 100000};
+
+#ifndef _WIN32
+    std::string dir = directory("cpu");
+    if (dir.empty())
+    {
+        return quota;
+    }
+
+    std::ifstream max(dir + "/cpu.max");
+    std::string value;
+    if (max >> value)
+    {
+        // "max 100000" or "200000 100000"
+        quota.quotaUs = value == "max" ? -1 : std::stoll(value);
+        max >> quota.periodUs;
+        return quota;
+    }
+
+    // cgroup v1
+    std::ifstream cfsQuota(dir + "/cpu.cfs_quota_us");
+    std::ifstream cfsPeriod(dir + "/cpu.cfs_period_us");
+    if (cfsQuota >> quota.quotaUs)
+    {
+        cfsPeriod >> quota.periodUs;
+    }
+#endif
+
+    return quota;
+}
+
+
+/**
+ * @brief Quota throttling counters of the process cgroup, all zeros when
+ * not available. Poll it and compare nrThrottled to detect quota stalls.
+ */
+inline Throttling throttling()
+{
+    Throttling stats = {0, 0, 0};
+
+#ifndef _WIN32
+    std::string dir = directory("cpu");
+    if (dir.empty())
+    {
+        return stats;
+    }
+
+    std::ifstream file(dir + "/cpu.stat");
+    std::string key;
+    uint64_t value;
+    while (file >> key >> value)
+    {
+        if (key == "nr_periods")
+        {
+            stats.nrPeriods = value;
+        }
+        else if (key == "nr_throttled")
+        {
+            stats.nrThrottled = value;
+        }
+        else if (key == "throttled_usec")
+        {
+            stats.throttledUsec = value;
+        }
+        else if (key == "throttled_time")
+        {
+            stats.throttledUsec = value / 1000; // cgroup v1 reports nanoseconds
+        }
+    }
+#endif
+
+    return stats;
+}
+
+
+/**
+ * @brief Number of worker threads that can run without being throttled:
+ * the smaller of the effective CPUs count and the CPU quota (rounded up).
+ */
+inline size_t suggestedPoolSize()
+{
+    size_t size = cpulist::count(effectiveCpus());
+    if (size == 0)
+    {
+        size = std::thread::hardware_concurrency();
+    }
+
+    Quota quota = cpuQuota();
+    if (quota.limited())
+    {
+        size = std::min(size, static_cast<size_t>(std::ceil(quota.cpus())));
+    }
+
+    return std::max<size_t>(size, 1);
+}
+
+
+/**
+ * @brief Restricts an affinity mask to the CPUs the process may run on.
+ *
+ * @param affinity Requested CPUs, an empty mask (no affinity) stays empty.
+ * @return The requested CPUs that are inside the effective cpuset.
+ *
+ * @throws std::runtime_error If none of the requested CPUs is usable.
+ */
+inline std::vector<bool> restrictAffinity(const std::vector<bool>& affinity)
+{
+    if (affinity.empty())
+    {
+        return affinity;
+    }
+
+    std::vector<bool> result = cpulist::intersect(affinity, effectiveCpus());
+    if (cpulist::count(result) == 0)
+    {
+        throw std::runtime_error("None of the requested CPUs (" + cpulist::format(affinity) +
+                                 ") is in the effective cpuset (" + cpulist::format(effectiveCpus()) + ")");
+    }
+    return result;
+}
+
+
+/**
+ * @brief Copy of the properties with the affinity restricted to the CPUs the
+ * process may run on, @see restrictAffinity(const std::vector<bool>&)
+ */
+inline thread::Properties restrictAffinity(const thread::Properties& properties)
+{
+    thread::Properties result = properties;
+    result.affinity = restrictAffinity(properties.affinity);
+    return result;
+}
+
+
+} // namespace cgroup
+} // namespace OSCompatible
+
+
+#endif //__cgroup__
@@ -0,0 +1,337 @@
+/**
+ * @file core_allocator.hpp
+ *
+ * @brief Process-wide allocator handing out exclusive (non-overlapping) CPU
+ * cores to latency critical threads, instead of every subsystem building
+ * Properties::affinity by hand.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __core_allocator__
+#define __core_allocator__
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <tuple>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/cpulist.hpp"
+#include "OSCompatible/topology.hpp"
+#include "OSCompatible/cgroup.hpp"
+
+
+namespace OSCompatible
+{
+
+class core_allocator;
+
+
+/**
+ * @brief CPUs exclusively allocated by the core_allocator, returned to it when
+ * the lease is destroyed (or released).
+ *
+ * Hand the lease to the thread using the CPUs with thread::hold() to return
+ * them when the thread is joined or destroyed.
+ */
+class core_lease
+{
+public:
+    core_lease();
+    ~core_lease();
+
+    core_lease(const core_lease&) = delete;
+    core_lease& operator=(const core_lease&) = delete;
+    core_lease(core_lease&& other) noexcept;
+    core_lease& operator=(core_lease&& other) noexcept;
+
+    // Allocated CPUs as an affinity mask
+    const std::vector<bool>& affinity() const;
+
+    // Copy of properties pinned to the allocated CPUs
+    thread::Properties properties(const thread::Properties& properties = thread::DEFAULT_PROPERTIES) const;
+
+    // Returns the CPUs to the allocator, the lease is empty afterwards
+    void release();
+
+private:
+    friend class core_allocator;
+    core_lease(core_allocator* allocator, const std::vector<bool>& cpus);
+
+    core_allocator* m_allocator;
+    std::vector<bool> m_cpus;
+};
+
+
+/**
+ * @brief Process-wide allocator of exclusive CPUs.
+ *
+ * Only CPUs that are online and inside the effective cpuset of the process
+ * (cgroup::effectiveCpus) are handed out, and a CPU is never in two leases at
+ * the same time.
+ *
+ * @code
+ * auto lease = OSCompatible::core_allocator::instance().acquire(2, {true, true});
+ * OSCompatible::thread t(lease.properties(rtProperties), hotLoop);
+ * t.hold(std::move(lease)); // cores are returned on t.join()
+ * @endcode
+ */
+class core_allocator
+{
+public:
+    struct Options
+    {
+        bool wholeCores = false;    // SMT-aware: allocate all the siblings of a physical core as one unit
+        bool preferIsolated = true; // Hand out isolcpus/nohz_full CPUs first
+    };
+
+    static core_allocator& instance();
+
+    /**
+     * @brief Allocates CPUs that are not allocated to anyone else.
+     *
+     * @param count Number of CPUs (or physical cores with wholeCores).
+     * @param options Allocation options.
+     * @return The lease owning the allocated CPUs.
+     *
+     * @throws std::runtime_error If there are not enough free CPUs, nothing is
+     * allocated then.
+     */
+    core_lease acquire(size_t count, const Options& options);
+    core_lease acquire(size_t count = 1);
+
+    // CPUs that can still be allocated
+    std::vector<bool> available() const;
+
+    // CPUs currently allocated
+    std::vector<bool> allocated() const;
+
+private:
+    friend class core_lease;
+    core_allocator() = default;
+
+    void Release(const std::vector<bool>& cpus);
+    std::vector<bool> Usable() const;
+
+    mutable std::mutex m_mutex;
+    std::vector<bool> m_allocated;
+};
+
+
+
+inline core_lease::core_lease()
+    :
+    m_allocator(nullptr),
+    m_cpus()
+{ }
+
+
+inline core_lease::core_lease(core_allocator* allocator, const std::vector<bool>& cpus)
+    :
+    m_allocator(allocator),
+    m_cpus(cpus)
+{ }
+
+
+inline core_lease::~core_lease()
+{
+    release();
+}
+
+
+inline core_lease::core_lease(core_lease&& other) noexcept
+    :
+    m_allocator(other.m_allocator),
+    m_cpus(std::move(other.m_cpus))
+{
+    other.m_allocator = nullptr;
+    other.m_cpus.clear();
+}
+
+
+inline core_lease& core_lease::operator=(core_lease&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_allocator = other.m_allocator;
+        m_cpus = std::move(other.m_cpus);
+        other.m_allocator = nullptr;
+        other.m_cpus.clear();
+    }
+    return *this;
+}
+
+
+inline const std::vector<bool>& core_lease::affinity() const
+{
+    return m_cpus;
+}
+
+
+inline thread::Properties core_lease::properties(const thread::Properties& properties) const
+{
+    thread::Properties result = properties;
+    result.affinity = m_cpus;
+    return result;
+}
+
+
+inline void core_lease::release()
+{
+    if (m_allocator != nullptr)
+    {
+        m_allocator->Release(m_cpus);
+        m_allocator = nullptr;
+    }
+    m_cpus.clear();
+}
+
+
+
+inline core_allocator& core_allocator::instance()
+{
+    static core_allocator allocator;
+    return allocator;
+}
+
+
+inline std::vector<bool> core_allocator::Usable() const
+{
+    return cpulist::intersect(topology::onlineCpus(), cgroup::effectiveCpus());
+}
+
+
+inline core_lease core_allocator::acquire(size_t count)
+{
+    return acquire(count, Options());
+}
+
+
+inline core_lease core_allocator::acquire(size_t count, const Options& options)
+{
+    std::vector<bool> usable = Usable();
+    std::vector<bool> isolated = options.preferIsolated ? topology::isolatedCpus() : std::vector<bool>();
+    auto isIsolated = [&isolated](size_t cpu) { return cpu < isolated.size() && isolated[cpu]; };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_allocated.size() < usable.size())
+    {
+        m_allocated.resize(usable.size(), false);
+    }
+
+    // Allocation units: physical cores (all their usable siblings) or single CPUs
+    std::vector<std::vector<bool>> units;
+    if (options.wholeCores)
+    {
+        for (auto& core : topology::cores(usable))
+        {
+            if (cpulist::count(cpulist::intersect(core, m_allocated)) == 0)
+            {
+                units.push_back(core);
+            }
+        }
+    }
+    else
+    {
+        for (size_t cpu = 0; cpu < usable.size(); ++cpu)
+        {
+            if (usable[cpu] && !m_allocated[cpu])
+            {
+                std::vector<bool> unit(cpu + 1, false);
+                unit[cpu] = true;
+                units.push_back(unit);
+            }
+        }
+    }
+
+    if (units.size() < count)
+    {
+        throw std::runtime_error("Failed to allocate " + std::to_string(count) + (options.wholeCores ? " cores" : " CPUs") +
+                                 ": only " + std::to_string(units.size()) + " free");
+    }
+
+    // Prefer isolated units, then units whose SMT siblings are not busy
+    auto firstCpu = [](const std::vector<bool>& unit) { return static_cast<size_t>(std::find(unit.begin(), unit.end(), true) - unit.begin()); };
+    auto rank = [&](const std::vector<bool>& unit)
+    {
+        size_t cpu = firstCpu(unit);
+        int isolatedRank = isIsolated(cpu) ? 0 : 1;
+        int siblingRank = cpulist::count(cpulist::intersect(topology::siblings(cpu), m_allocated)) == 0 ? 0 : 1;
+        return std::make_tuple(isolatedRank, siblingRank, cpu);
+    };
+
+    std::vector<std::tuple<int, int, size_t>> ranks;
+    for (auto& unit : units)
+    {
+        ranks.push_back(rank(unit));
+    }
+
+    std::vector<size_t> order(units.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&ranks](size_t a, size_t b) { return ranks[a] < ranks[b]; });
+
+    std::vector<bool> cpus(m_allocated.size(), false);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const std::vector<bool>& unit = units[order[i]];
+        for (size_t cpu = 0; cpu < unit.size(); ++cpu)
+        {
+            if (unit[cpu])
+            {
+                cpus[cpu] = true;
+                m_allocated[cpu] = true;
+            }
+        }
+    }
+
+    return core_lease(this, cpus);
+}
+
+
+inline void core_allocator::Release(const std::vector<bool>& cpus)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (size_t cpu = 0; cpu < cpus.size() && cpu < m_allocated.size(); ++cpu)
+    {
+        if (cpus[cpu])
+        {
+            m_allocated[cpu] = false;
+        }
+    }
+}
+
+
+inline std::vector<bool> core_allocator::available() const
+{
+    std::vector<bool> usable = Usable();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t cpu = 0; cpu < usable.size() && cpu < m_allocated.size(); ++cpu)
+    {
+        usable[cpu] = usable[cpu] && !m_allocated[cpu];
+    }
+    return usable;
+}
+
+
+inline std::vector<bool> core_allocator::allocated() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_allocated;
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__core_allocator__
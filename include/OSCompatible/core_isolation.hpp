@@ -0,0 +1,329 @@
+/**
+ * @file core_isolation.hpp
+ *
+ * @brief Keeps reserved CPU cores to the threads pinned on them, by moving
+ * every other thread of the process (allocator background threads, logging,
+ * third party pools...) off the reserved cores, and keeps enforcing it as new
+ * threads appear.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __core_isolation__
+#define __core_isolation__
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/cpulist.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Moves the threads of the process off a reserved set of CPUs.
+ *
+ * A thread whose affinity is entirely inside the reserved set is considered
+ * an owner of reserved cores (a pinned hot thread) and is left alone, every
+ * other thread that may run on a reserved CPU gets the reserved CPUs removed
+ * from its affinity. Threads can also be exempted explicitly by their tid.
+ *
+ * OSCompatible threads registered (see registry.hpp) with an affinity inside
+ * the reserved set are owners whatever their current mask: their affinity is
+ * applied right after clone, possibly between the read and the write of a
+ * pass, which then restores it.
+ *
+ * @code
+ * auto lease = OSCompatible::core_allocator::instance().acquire(2);
+ * OSCompatible::thread hot(lease.properties(), hotLoop);
+ * OSCompatible::core_isolation isolation(lease.affinity()); // enforces every 100ms until destroyed
+ * @endcode
+ *
+ * @note Linux only, on Windows nothing is migrated.
+ * @warning Re-pinning threads of other owners may need CAP_SYS_NICE when they
+ * run under a different user, such failures are skipped.
+ */
+class core_isolation
+{
+public:
+    /**
+     * @brief Migrates the threads off the reserved CPUs and starts a
+     * background thread re-checking it every interval.
+     *
+     * @param reserved The reserved CPUs.
+     * @param interval Period of the enforcement, zero to migrate only once.
+     */
+    explicit core_isolation(const std::vector<bool>& reserved,
+                            std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+
+    // Stops enforcing, migrated threads are not moved back
+    ~core_isolation();
+
+    core_isolation(const core_isolation&) = delete;
+    core_isolation& operator=(const core_isolation&) = delete;
+
+    // Never migrate the thread with this kernel tid
+    void exempt(long tid);
+
+    // Runs one enforcement pass, @return number of migrated threads
+    size_t enforce();
+
+    /**
+     * @brief One-shot migration of all the threads of the process that may run
+     * on the reserved CPUs (except the owners and the exempted tids).
+     *
+     * @return Number of migrated threads.
+     */
+    static size_t migrate(const std::vector<bool>& reserved, const std::set<long>& exempted = {});
+
+private:
+    void Run();
+
+#ifndef _WIN32
+    // Configured affinity of the registered threads pinned inside the reserved set, by tid
+    static std::map<long, std::vector<bool>> Owners(const std::vector<bool>& reserved);
+    static bool SetAffinity(long tid, const std::vector<bool>& cpus);
+#endif
+
+    std::vector<bool> m_reserved;
+    std::chrono::milliseconds m_interval;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+    std::set<long> m_exempted;
+    std::unique_ptr<thread> m_enforcer;
+};
+
+
+
+inline core_isolation::core_isolation(const std::vector<bool>& reserved, std::chrono::milliseconds interval)
+    :
+    m_reserved(reserved),
+    m_interval(interval),
+    m_mutex(),
+    m_cv(),
+    m_stop(false),
+    m_exempted(),
+    m_enforcer()
+{
+    enforce();
+
+    if (m_interval.count() > 0)
+    {
+        m_enforcer = std::make_unique<thread>(&core_isolation::Run, this);
+    }
+}
+
+
+inline core_isolation::~core_isolation()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+
+    if (m_enforcer && m_enforcer->joinable())
+    {
+        m_enforcer->join();
+    }
+}
+
+
+inline void core_isolation::exempt(long tid)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_exempted.insert(tid);
+}
+
+
+inline size_t core_isolation::enforce()
+{
+    std::set<long> exempted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        exempted = m_exempted;
+    }
+    return migrate(m_reserved, exempted);
+}
+
+
+inline void core_isolation::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_cv.wait_for(lock, m_interval, [this]() { return m_stop; }))
+    {
+        lock.unlock();
+        enforce();
+        lock.lock();
+    }
+}
+
+
+#ifndef _WIN32
+
+inline std::map<long, std::vector<bool>> core_isolation::Owners(const std::vector<bool>& reserved)
+{
+    std::map<long, std::vector<bool>> owners;
+
+    for (const auto& entry : registry::snapshot())
+    {
+        const std::vector<bool>& affinity = entry.properties.affinity;
+        bool inside = cpulist::count(affinity) != 0;
+        for (size_t cpu = 0; cpu < affinity.size() && inside; ++cpu)
+        {
+            inside = !affinity[cpu] || (cpu < reserved.size() && reserved[cpu]);
+        }
+        if (inside)
+        {
+            owners[entry.tid] = affinity;
+        }
+    }
+    return owners;
+}
+
+
+inline bool core_isolation::SetAffinity(long tid, const std::vector<bool>& cpus)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (size_t cpu = 0; cpu < cpus.size() && cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (cpus[cpu])
+        {
+            CPU_SET(cpu, &cpuset);
+        }
+    }
+    return sched_setaffinity(static_cast<pid_t>(tid), sizeof(cpuset), &cpuset) == 0;
+}
+
+#endif
+
+
+inline size_t core_isolation::migrate(const std::vector<bool>& reserved, const std::set<long>& exempted)
+{
+    size_t migrated = 0;
+
+#ifndef _WIN32
+    const std::map<long, std::vector<bool>> owners = Owners(reserved);
+
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks == nullptr)
+    {
+        return 0;
+    }
+
+    while (dirent* entry = readdir(tasks))
+    {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+        {
+            continue; // "." and ".."
+        }
+
+        long tid = std::strtol(entry->d_name, nullptr, 10);
+        if (exempted.count(tid) != 0)
+        {
+            continue;
+        }
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        if (sched_getaffinity(static_cast<pid_t>(tid), sizeof(cpuset), &cpuset) != 0)
+        {
+            continue; // the thread already exited
+        }
+
+        // Registered owner: back on its configured CPUs if an earlier pass raced with its pinning
+        auto owner = owners.find(tid);
+        if (owner != owners.end())
+        {
+            bool onConfigured = false;
+            for (size_t cpu = 0; cpu < owner->second.size() && cpu < CPU_SETSIZE; ++cpu)
+            {
+                onConfigured = onConfigured || (owner->second[cpu] && CPU_ISSET(cpu, &cpuset));
+            }
+            if (!onConfigured)
+            {
+                SetAffinity(tid, owner->second);
+            }
+            continue;
+        }
+
+        bool onReserved = false;
+        bool outsideReserved = false;
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (!CPU_ISSET(cpu, &cpuset))
+            {
+                continue;
+            }
+            bool isReserved = cpu < reserved.size() && reserved[cpu];
+            onReserved = onReserved || isReserved;
+            outsideReserved = outsideReserved || !isReserved;
+        }
+
+        // Owners (entirely inside the reserved set) and threads that already
+        // can't run on reserved CPUs are left alone
+        if (!onReserved || !outsideReserved)
+        {
+            continue;
+        }
+
+        for (size_t cpu = 0; cpu < reserved.size() && cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (reserved[cpu])
+            {
+                CPU_CLR(cpu, &cpuset);
+            }
+        }
+
+        if (sched_setaffinity(static_cast<pid_t>(tid), sizeof(cpuset), &cpuset) != 0)
+        {
+            continue;
+        }
+
+        // A new OSCompatible thread may have pinned itself on reserved CPUs
+        // between the get and the set, undo the migration if it registered so
+        const std::map<long, std::vector<bool>> lateOwners = Owners(reserved);
+        auto late = lateOwners.find(tid);
+        if (late != lateOwners.end())
+        {
+            SetAffinity(tid, late->second);
+            continue;
+        }
+        ++migrated;
+    }
+
+    closedir(tasks);
+#else
+    (void)reserved;
+    (void)exempted;
+#endif
+
+    return migrated;
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__core_isolation__
@@ -0,0 +1,188 @@
+/**
+ * @file cpulist.hpp
+ *
+ * @brief Helpers to convert between kernel CPU list strings ("0-3,8,10-11")
+ * and the affinity masks used by thread::Properties.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __cpulist__
+#define __cpulist__
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace OSCompatible
+{
+namespace cpulist
+{
+
+
+/**
+ * @brief Parses a CPU list in the kernel format ("0-3,8,10-11", used by
+ * isolcpus, cpuset.cpus, /sys/devices/system/cpu/online...).
+ *
+ * @param list The CPU list, may be empty (returns an empty mask).
+ * @return Affinity mask, index i is true when CPU i is in the list.
+ *
+ * @throws std::runtime_error If the list is malformed.
+ */
+inline std::vector<bool> parse(const std::string& list)
+{
+    std::vector<bool> mask;
+    size_t pos = 0;
+
+    auto readNumber = [&list, &pos]() -> size_t
+    {
+        size_t begin = pos;
+        while (pos < list.size() && list[pos] >= '0' && list[pos] <= '9')
+        {
+            ++pos;
+        }
+        if (begin == pos)
+        {
+            throw std::runtime_error("Invalid CPU list: \"" + list + "\"");
+        }
+        return std::stoul(list.substr(begin, pos - begin));
+    };
+
+    while (pos < list.size())
+    {
+        if (list[pos] == ' ' || list[pos] == '\n' || list[pos] == '\t')
+        {
+            ++pos;
+            continue;
+        }
+
+        size_t first = readNumber();
+        size_t last = first;
+        if (pos < list.size() && list[pos] == '-')
+        {
+            ++pos;
+            last = readNumber();
+        }
+        if (last < first)
+        {
+            throw std::runtime_error("Invalid CPU list range: \"" + list + "\"");
+        }
+
+        if (mask.size() <= last)
+        {
+            mask.resize(last + 1, false);
+        }
+        for (size_t cpu = first; cpu <= last; ++cpu)
+        {
+            mask[cpu] = true;
+        }
+
+        if (pos < list.size() && list[pos] == ',')
+        {
+            ++pos;
+        }
+        else if (pos < list.size() && list[pos] != ' ' && list[pos] != '\n' && list[pos] != '\t')
+        {
+            throw std::runtime_error("Invalid CPU list: \"" + list + "\"");
+        }
+    }
+
+    return mask;
+}
+
+
+/**
+ * @brief Formats an affinity mask as a kernel CPU list ("0-3,8").
+ */
+inline std::string format(const std::vector<bool>& mask)
+{
+    std::string list;
+
+    for (size_t cpu = 0; cpu < mask.size(); ++cpu)
+    {
+        if (!mask[cpu])
+        {
+            continue;
+        }
+
+        size_t last = cpu;
+        while (last + 1 < mask.size() && mask[last + 1])
+        {
+            ++last;
+        }
+
+        if (!list.empty())
+        {
+            list += ',';
+        }
+        list += std::to_string(cpu);
+        if (last != cpu)
+        {
+            list += '-' + std::to_string(last);
+        }
+        cpu = last;
+    }
+
+    return list;
+}
+
+
+/**
+ * @brief Reads a CPU list file (/sys/devices/system/cpu/isolated,
+ * cpuset.cpus.effective...).
+ *
+ * @return The parsed mask, empty if the file doesn't exist or is empty.
+ */
+inline std::vector<bool> read(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+
+    if (!file || !std::getline(file, line))
+    {
+        return {};
+    }
+    return parse(line);
+}
+
+
+/**
+ * @brief CPUs set in both masks.
+ */
+inline std::vector<bool> intersect(const std::vector<bool>& a, const std::vector<bool>& b)
+{
+    std::vector<bool> result(std::min(a.size(), b.size()), false);
+
+    for (size_t cpu = 0; cpu < result.size(); ++cpu)
+    {
+        result[cpu] = a[cpu] && b[cpu];
+    }
+    return result;
+}
+
+
+/**
+ * @brief Number of CPUs set in the mask.
+ */
+inline size_t count(const std::vector<bool>& mask)
+{
+    size_t cnt = 0;
+
+    for (bool cpu : mask)
+    {
+        cnt += cpu ? 1 : 0;
+    }
+    return cnt;
+}
+
+
+} // namespace cpulist
+} // namespace OSCompatible
+
+
+#endif //__cpulist__
@@ -0,0 +1,135 @@
+/**
+ * @file futex.hpp
+ *
+ * @brief Wait on a 32-bit atomic word until another thread wakes it: the
+ * futex syscall on Linux, WaitOnAddress on Windows. The building block of
+ * the parking idle strategies and of the spin-then-park primitives.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __futex__
+#define __futex__
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+
+#ifdef _WIN32       // Windows
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else               // Linux
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Futex operations on a std::atomic<uint32_t>, private to the process.
+ *
+ * @code
+ * // Waiter                                         // Waker
+ * while (ready.load() == 0)                          ready.store(1);
+ * {                                                  OSCompatible::futex::wakeOne(ready);
+ *     OSCompatible::futex::wait(ready, 0);
+ * }
+ * @endcode
+ */
+class futex
+{
+public:
+    /**
+     * @brief Sleeps while word holds expected, until woken.
+     *
+     * Returns immediately if the word already changed, and may return
+     * spuriously, so callers re-check their condition in a loop.
+     *
+     * @param timeout Longest sleep, negative for no limit.
+     * @return false if the timeout expired.
+     */
+    static bool wait(std::atomic<uint32_t>& word, uint32_t expected,
+                     std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1));
+
+    // Wakes one thread waiting on word
+    static void wakeOne(std::atomic<uint32_t>& word);
+
+    // Wakes every thread waiting on word
+    static void wakeAll(std::atomic<uint32_t>& word);
+
+private:
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit integers");
+
+#ifndef _WIN32
+    static long Call(std::atomic<uint32_t>& word, int operation, uint32_t value, const struct timespec* timeout);
+#endif
+};
+
+
+
+#ifndef _WIN32
+inline long futex::Call(std::atomic<uint32_t>& word, int operation, uint32_t value, const struct timespec* timeout)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), operation, value, timeout, nullptr, 0);
+}
+#endif
+
+
+inline bool futex::wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::nanoseconds timeout)
+{
+#ifdef _WIN32
+    const DWORD milliseconds = timeout.count() < 0 ? INFINITE
+        : static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
+    if (!WaitOnAddress(&word, &expected, sizeof(expected), milliseconds))
+    {
+        return GetLastError() != ERROR_TIMEOUT;
+    }
+    return true;
+#else
+    struct timespec relative;
+    struct timespec* limit = nullptr;
+    if (timeout.count() >= 0)
+    {
+        relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000000LL);
+        relative.tv_nsec = static_cast<long>(timeout.count() % 1000000000LL);
+        limit = &relative;
+    }
+
+    // EAGAIN (word already changed) and EINTR are wakeups for the caller loop
+    return Call(word, FUTEX_WAIT_PRIVATE, expected, limit) == 0 || errno != ETIMEDOUT;
+#endif
+}
+
+
+inline void futex::wakeOne(std::atomic<uint32_t>& word)
+{
+#ifdef _WIN32
+    WakeByAddressSingle(&word);
+#else
+    Call(word, FUTEX_WAKE_PRIVATE, 1, nullptr);
+#endif
+}
+
+
+inline void futex::wakeAll(std::atomic<uint32_t>& word)
+{
+#ifdef _WIN32
+    WakeByAddressAll(&word);
+#else
+    Call(word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr);
+#endif
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__futex__
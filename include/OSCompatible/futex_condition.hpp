@@ -0,0 +1,289 @@
+/**
+ * @file futex_condition.hpp
+ *
+ * @brief Condition variable with one futex word per waiter: notify_one wakes
+ * exactly the oldest waiter, and notify_all wakes the waiters one after the
+ * other as each reacquires the mutex, instead of a thundering herd all
+ * fighting for the mutex at once.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __futex_condition__
+#define __futex_condition__
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "OSCompatible/futex.hpp"
+#include "OSCompatible/spin_mutex.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Condition variable for any BasicLockable (spin_mutex, std::mutex...).
+ *
+ * Waiters are queued in FIFO order. A notification is only delivered to the
+ * threads waiting at the time of the call, like std::condition_variable.
+ *
+ * @code
+ * OSCompatible::spin_mutex mutex;
+ * OSCompatible::futex_condition ready;
+ *
+ * // Consumer                                          // Producer
+ * std::unique_lock<OSCompatible::spin_mutex> lock(mutex); {
+ * ready.wait(lock, [&]() { return !queue.empty(); });      std::lock_guard<OSCompatible::spin_mutex> lock(mutex);
+ * auto task = queue.pop();                                 queue.push(task);
+ *                                                      }
+ *                                                      ready.notify_one();
+ * @endcode
+ */
+class futex_condition
+{
+public:
+    futex_condition();
+
+    futex_condition(const futex_condition&) = delete;
+    futex_condition& operator=(const futex_condition&) = delete;
+
+    // Wakes the oldest waiter
+    void notify_one();
+
+    // Wakes all the current waiters, each one once its predecessor holds the mutex
+    void notify_all();
+
+    // Releases lock, waits for a notification (or spuriously) and reacquires lock
+    template <typename Lock>
+    void wait(Lock& lock);
+
+    template <typename Lock, typename Predicate>
+    void wait(Lock& lock, Predicate predicate);
+
+    template <typename Lock, typename Rep, typename Period>
+    std::cv_status wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout);
+
+    template <typename Lock, typename Rep, typename Period, typename Predicate>
+    bool wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout, Predicate predicate);
+
+private:
+    struct Waiter
+    {
+        std::atomic<uint32_t> signaled{0};  // Futex word of this waiter only
+        Waiter* next = nullptr;
+        Waiter* prev = nullptr;
+        Waiter* chain = nullptr;            // Next waiter of a notify_all, woken once this one holds the mutex
+        bool queued = false;
+    };
+
+    void Enqueue(Waiter& waiter);
+    bool Dequeue(Waiter& waiter);
+    static void Signal(Waiter* waiter);
+
+    template <typename Lock>
+    std::cv_status Wait(Lock& lock, std::chrono::nanoseconds timeout);
+
+    spin_mutex m_mutex;     // Guards the queue
+    Waiter* m_head;
+    Waiter* m_tail;
+};
+
+
+
+inline futex_condition::futex_condition()
+    :
+    m_mutex(),
+    m_head(nullptr),
+    m_tail(nullptr)
+{ }
+
+
+inline void futex_condition::Enqueue(Waiter& waiter)
+{
+    std::lock_guard<spin_mutex> lock(m_mutex);
+
+    waiter.prev = m_tail;
+    waiter.next = nullptr;
+    waiter.queued = true;
+    if (m_tail != nullptr)
+    {
+        m_tail->next = &waiter;
+    }
+    else
+    {
+        m_head = &waiter;
+    }
+    m_tail = &waiter;
+}
+
+
+// Removes a waiter that is still queued (timeout), false if it was already notified
+inline bool futex_condition::Dequeue(Waiter& waiter)
+{
+    std::lock_guard<spin_mutex> lock(m_mutex);
+
+    if (!waiter.queued)
+    {
+        return false;
+    }
+
+    (waiter.prev != nullptr ? waiter.prev->next : m_head) = waiter.next;
+    (waiter.next != nullptr ? waiter.next->prev : m_tail) = waiter.prev;
+    waiter.queued = false;
+    return true;
+}
+
+
+inline void futex_condition::Signal(Waiter* waiter)
+{
+    // The waiter may return and destroy its node as soon as signaled is set
+    std::atomic<uint32_t>& signaled = waiter->signaled;
+    signaled.store(1, std::memory_order_release);
+    futex::wakeOne(signaled);
+}
+
+
+inline void futex_condition::notify_one()
+{
+    Waiter* waiter;
+    {
+        std::lock_guard<spin_mutex> lock(m_mutex);
+
+        waiter = m_head;
+        if (waiter == nullptr)
+        {
+            return;
+        }
+
+        m_head = waiter->next;
+        (m_head != nullptr ? m_head->prev : m_tail) = nullptr;
+        waiter->queued = false;
+    }
+    Signal(waiter);
+}
+
+
+inline void futex_condition::notify_all()
+{
+    Waiter* first;
+    {
+        std::lock_guard<spin_mutex> lock(m_mutex);
+
+        first = m_head;
+        if (first == nullptr)
+        {
+            return;
+        }
+
+        // Detach the whole queue as a chain, the waiters hand the wakeup on one by one
+        for (Waiter* waiter = first; waiter != nullptr; waiter = waiter->next)
+        {
+            waiter->chain = waiter->next;
+            waiter->queued = false;
+        }
+        m_head = nullptr;
+        m_tail = nullptr;
+    }
+    Signal(first);
+}
+
+
+template <typename Lock>
+std::cv_status futex_condition::Wait(Lock& lock, std::chrono::nanoseconds timeout)
+{
+    Waiter waiter;
+    Enqueue(waiter);
+    lock.unlock();
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::cv_status status = std::cv_status::no_timeout;
+
+    while (waiter.signaled.load(std::memory_order_acquire) == 0)
+    {
+        std::chrono::nanoseconds remaining(-1);
+        if (timeout.count() >= 0 && status == std::cv_status::no_timeout)
+        {
+            remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                if (Dequeue(waiter))
+                {
+                    status = std::cv_status::timeout;
+                    break;
+                }
+                // Already notified, the signal is on its way and the node must outlive it
+                status = std::cv_status::timeout;
+                remaining = std::chrono::nanoseconds(-1);
+            }
+        }
+        futex::wait(waiter.signaled, 0, remaining);
+    }
+
+    lock.lock();
+
+    // Continue a notify_all chain now that this waiter holds the mutex
+    if (waiter.signaled.load(std::memory_order_relaxed) != 0)
+    {
+        status = std::cv_status::no_timeout;
+        if (waiter.chain != nullptr)
+        {
+            Signal(waiter.chain);
+        }
+    }
+    return status;
+}
+
+
+template <typename Lock>
+void futex_condition::wait(Lock& lock)
+{
+    Wait(lock, std::chrono::nanoseconds(-1));
+}
+
+
+template <typename Lock, typename Predicate>
+void futex_condition::wait(Lock& lock, Predicate predicate)
+{
+    while (!predicate())
+    {
+        Wait(lock, std::chrono::nanoseconds(-1));
+    }
+}
+
+
+template <typename Lock, typename Rep, typename Period>
+std::cv_status futex_condition::wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout)
+{
+    const auto limit = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+    return Wait(lock, limit.count() < 0 ? std::chrono::nanoseconds(0) : limit);
+}
+
+
+template <typename Lock, typename Rep, typename Period, typename Predicate>
+bool futex_condition::wait_for(Lock& lock, const std::chrono::duration<Rep, Period>& timeout, Predicate predicate)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate())
+    {
+        const auto remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= decltype(remaining)::zero()
+            || wait_for(lock, remaining) == std::cv_status::timeout)
+        {
+            return predicate();
+        }
+    }
+    return true;
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__futex_condition__
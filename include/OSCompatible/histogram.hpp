@@ -0,0 +1,406 @@
+/**
+ * @file histogram.hpp
+ *
+ * @brief HDR-style log-linear latency histogram: allocation-free lock-free
+ * recording, per-thread histograms merged on read, percentile summaries for
+ * the stats and tracing surfaces.
+ *
+ * Values (nanoseconds) are kept in buckets of 1/64 of their power of two, so
+ * every recorded value is known within 1.6% from 0 up to 2^63, with a fixed
+ * 29KB of counters and no configuration.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __histogram__
+#define __histogram__
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Log-linear histogram of non-negative values.
+ *
+ * record() is a few relaxed atomic operations, safe from any number of
+ * threads, but a histogram written by a single thread avoids sharing its
+ * cache lines, @see histogram_group.
+ */
+class histogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 7;                       // 2^7 sub-buckets, 64 per power of two above 128
+    static constexpr size_t HALF_SUB_BUCKETS = size_t(1) << (SUB_BUCKET_BITS - 1);
+    static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * HALF_SUB_BUCKETS;
+
+    struct Summary
+    {
+        uint64_t count;
+        int64_t min;
+        int64_t max;
+        double mean;
+        int64_t p50;
+        int64_t p90;
+        int64_t p99;
+        int64_t p999;
+
+        // "count=... min=... p50=... p90=... p99=... p99.9=... max=... mean=..."
+        std::string format() const;
+    };
+
+    histogram();
+
+    histogram(const histogram&) = delete;
+    histogram& operator=(const histogram&) = delete;
+
+    // Negative values are recorded as 0
+    void record(int64_t value);
+
+    // Adds the values of another histogram (merge-on-read aggregation)
+    void merge(const histogram& other);
+
+    // Forgets all the values, values recorded meanwhile may be partially kept
+    void reset();
+
+    uint64_t count() const;
+    int64_t min() const;
+    int64_t max() const;
+    double mean() const;
+
+    /**
+     * @brief Value at a percentile, the highest value equivalent to the
+     * bucket holding it (never more than max()).
+     *
+     * @param percentile In [0, 100].
+     */
+    int64_t percentile(double percentile) const;
+
+    Summary summary() const;
+
+    // Bucket of a value, and the highest value of a bucket
+    static size_t index(int64_t value);
+    static int64_t highestEquivalent(size_t index);
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<int64_t> m_sum;
+    std::atomic<int64_t> m_min;
+    std::atomic<int64_t> m_max;
+};
+
+
+/**
+ * @brief Per-thread histograms of one measurement (wakeup latency, queue
+ * wait, task duration...) aggregated on read.
+ *
+ * @code
+ * static OSCompatible::histogram_group taskDuration;
+ * ...
+ * taskDuration.local().record(durationNs);          // in each worker, no sharing, no lock
+ * ...
+ * std::cout << taskDuration.summary().format();     // merged over all the workers
+ * @endcode
+ */
+class histogram_group
+{
+public:
+    histogram_group();
+
+    histogram_group(const histogram_group&) = delete;
+    histogram_group& operator=(const histogram_group&) = delete;
+
+    // Histogram of the calling thread, allocated on the first call only
+    histogram& local();
+
+    // Adds the histograms of all the threads into result
+    void mergeInto(histogram& result) const;
+
+    // Summary of the histograms of all the threads
+    histogram::Summary summary() const;
+
+    // Resets the histograms of all the threads
+    void reset();
+
+private:
+    static uint64_t NextId();
+
+    uint64_t m_id;  // Never reused, so per-thread lookups never match a destroyed group
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<histogram>> m_histograms;
+};
+
+
+
+inline histogram::histogram()
+    :
+    m_count(0),
+    m_sum(0),
+    m_min(INT64_MAX),
+    m_max(0)
+{
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        m_buckets[bucket].store(0, std::memory_order_relaxed);
+    }
+}
+
+
+inline size_t histogram::index(int64_t value)
+{
+    const uint64_t v = value > 0 ? static_cast<uint64_t>(value) : 0;
+    if (v < (uint64_t(1) << SUB_BUCKET_BITS))
+    {
+        return static_cast<size_t>(v);
+    }
+
+    // Keep the SUB_BUCKET_BITS most significant bits of the value
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanReverse64(&bit, v);
+    const int msb = static_cast<int>(bit);
+#else
+    const int msb = 63 - __builtin_clzll(v);
+#endif
+    const int shift = msb - SUB_BUCKET_BITS + 1;
+    return static_cast<size_t>(shift) * HALF_SUB_BUCKETS + static_cast<size_t>(v >> shift);
+}
+
+
+inline int64_t histogram::highestEquivalent(size_t index)
+{
+    if (index < (size_t(1) << SUB_BUCKET_BITS))
+    {
+        return static_cast<int64_t>(index);
+    }
+
+    const size_t shift = index / HALF_SUB_BUCKETS - 1;
+    const uint64_t sub = index % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+    const uint64_t highest = ((sub + 1) << shift) - 1;
+    return highest > static_cast<uint64_t>(INT64_MAX) ? INT64_MAX : static_cast<int64_t>(highest);
+}
+
+
+inline void histogram::record(int64_t value)
+{
+    if (value < 0)
+    {
+        value = 0;
+    }
+
+    m_buckets[index(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    int64_t current = m_min.load(std::memory_order_relaxed);
+    while (value < current && !m_min.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    { }
+
+    current = m_max.load(std::memory_order_relaxed);
+    while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    { }
+}
+
+
+inline void histogram::merge(const histogram& other)
+{
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        const uint64_t count = other.m_buckets[bucket].load(std::memory_order_relaxed);
+        if (count != 0)
+        {
+            m_buckets[bucket].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+    m_count.fetch_add(other.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_sum.fetch_add(other.m_sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    const int64_t otherMin = other.m_min.load(std::memory_order_relaxed);
+    int64_t current = m_min.load(std::memory_order_relaxed);
+    while (otherMin < current && !m_min.compare_exchange_weak(current, otherMin, std::memory_order_relaxed))
+    { }
+
+    const int64_t otherMax = other.m_max.load(std::memory_order_relaxed);
+    current = m_max.load(std::memory_order_relaxed);
+    while (otherMax > current && !m_max.compare_exchange_weak(current, otherMax, std::memory_order_relaxed))
+    { }
+}
+
+
+inline void histogram::reset()
+{
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        m_buckets[bucket].store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(INT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+
+inline uint64_t histogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+
+inline int64_t histogram::min() const
+{
+    return count() == 0 ? 0 : m_min.load(std::memory_order_relaxed);
+}
+
+
+inline int64_t histogram::max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+
+inline double histogram::mean() const
+{
+    const uint64_t samples = count();
+    return samples == 0 ? 0.0 : static_cast<double>(m_sum.load(std::memory_order_relaxed)) / static_cast<double>(samples);
+}
+
+
+inline int64_t histogram::percentile(double percentile) const
+{
+    // Count the buckets themselves, m_count may run ahead of them while recording
+    uint64_t total = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        total += m_buckets[bucket].load(std::memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total) + 0.5);
+    rank = rank == 0 ? 1 : (rank > total ? total : rank);
+
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+    {
+        seen += m_buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            const int64_t highest = highestEquivalent(bucket);
+            return highest < max() ? highest : max();
+        }
+    }
+    return max();
+}
+
+
+inline histogram::Summary histogram::summary() const
+{
+    return {count(), min(), max(), mean(), percentile(50.0), percentile(90.0), percentile(99.0), percentile(99.9)};
+}
+
+
+inline std::string histogram::Summary::format() const
+{
+    char text[256];
+    std::snprintf(text, sizeof(text),
+                  "count=%llu min=%lld p50=%lld p90=%lld p99=%lld p99.9=%lld max=%lld mean=%.1f",
+                  static_cast<unsigned long long>(count), static_cast<long long>(min), static_cast<long long>(p50),
+                  static_cast<long long>(p90), static_cast<long long>(p99), static_cast<long long>(p999),
+                  static_cast<long long>(max), mean);
+    return text;
+}
+
+
+
+inline uint64_t histogram_group::NextId()
+{
+    static std::atomic<uint64_t> next(1);
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+inline histogram_group::histogram_group()
+    :
+    m_id(NextId()),
+    m_mutex(),
+    m_histograms()
+{ }
+
+
+inline histogram& histogram_group::local()
+{
+    struct Local
+    {
+        uint64_t group;
+        histogram* values;
+    };
+    thread_local std::vector<Local> locals;
+
+    for (const Local& entry : locals)
+    {
+        if (entry.group == m_id)
+        {
+            return *entry.values;
+        }
+    }
+
+    histogram* created;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_histograms.push_back(std::make_unique<histogram>());
+        created = m_histograms.back().get();
+    }
+    locals.push_back({m_id, created});
+    return *created;
+}
+
+
+inline void histogram_group::mergeInto(histogram& result) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& h : m_histograms)
+    {
+        result.merge(*h);
+    }
+}
+
+
+inline histogram::Summary histogram_group::summary() const
+{
+    auto merged = std::make_unique<histogram>();
+    mergeInto(*merged);
+    return merged->summary();
+}
+
+
+inline void histogram_group::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& h : m_histograms)
+    {
+        h->reset();
+    }
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__histogram__
@@ -0,0 +1,364 @@
+/**
+ * @file idle_strategy.hpp
+ *
+ * @brief Idle strategies of polling worker loops, chosen at compile time:
+ * busy spinning for latency-critical cores, spinning then yielding, spinning
+ * then parking on a futex until notified, or sleeping with an exponential
+ * backoff for background workers.
+ *
+ * A strategy is any class with
+ *  void idle(size_t work)  - called after each poll with the work it did,
+ *                            resets on work, escalates on consecutive idle polls
+ *  void reset()            - back to the cheapest wait
+ *  void wake()             - ends a parked or sleeping wait early (stop requests)
+ * and is used by value as a template parameter (@see worker_thread), so the
+ * loop has no virtual call and each strategy inlines into it.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __idle_strategy__
+#define __idle_strategy__
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+
+#include "OSCompatible/futex.hpp"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+
+namespace OSCompatible
+{
+namespace idle
+{
+
+
+// Spin-wait hint to the CPU (pause/yield instruction), frees the SMT sibling and saves power
+inline void pause()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+
+/**
+ * @brief Wakeup signal of the parked workers: producers notify() after
+ * publishing work, parking strategies sleep on it.
+ *
+ * Notifying costs an atomic increment, plus a syscall only while a worker is
+ * parked.
+ */
+class wakeup_signal
+{
+public:
+    wakeup_signal();
+
+    wakeup_signal(const wakeup_signal&) = delete;
+    wakeup_signal& operator=(const wakeup_signal&) = delete;
+
+    // Wakes one parked worker
+    void notify();
+
+    // Wakes every parked worker
+    void notifyAll();
+
+    // Current notification count, taken before polling for work
+    uint32_t sequence() const;
+
+    // Sleeps unless notified since sequence() returned seen
+    void park(uint32_t seen);
+
+private:
+    std::atomic<uint32_t> m_sequence;
+    std::atomic<uint32_t> m_parked;
+};
+
+
+// Never gives up the CPU: lowest wakeup latency, burns its core while idle
+class busy_spin
+{
+public:
+    void idle(size_t work);
+    void reset();
+    void wake();
+};
+
+
+// Spins, then yields the CPU to other runnable threads of the core
+class spin_yield
+{
+public:
+    explicit spin_yield(uint32_t spins = 100);
+
+    void idle(size_t work);
+    void reset();
+    void wake();
+
+private:
+    uint32_t m_spins;
+    uint32_t m_count;
+};
+
+
+/**
+ * @brief Spins, yields, then parks on a signal until a producer notifies it:
+ * no CPU burnt while idle, a futex wakeup on the first work after parking.
+ *
+ * @code
+ * OSCompatible::idle::wakeup_signal wakeup;
+ * OSCompatible::worker_thread<OSCompatible::idle::spin_park> worker(props, drainQueue,
+ *                                                                 OSCompatible::idle::spin_park(wakeup));
+ * queue.push(task);
+ * wakeup.notify();
+ * @endcode
+ */
+class spin_park
+{
+public:
+    explicit spin_park(wakeup_signal& wakeup, uint32_t spins = 100, uint32_t yields = 10);
+
+    void idle(size_t work);
+    void reset();
+    void wake();
+
+private:
+    wakeup_signal* m_signal;
+    uint32_t m_spins;
+    uint32_t m_yields;
+    uint32_t m_count;
+    uint32_t m_seen;    // Sequence taken before the next poll, so no notification is missed
+};
+
+
+// Spins, then sleeps for an exponentially growing time, for background workers
+class backoff_sleep
+{
+public:
+    explicit backoff_sleep(std::chrono::nanoseconds minSleep = std::chrono::microseconds(1),
+                           std::chrono::nanoseconds maxSleep = std::chrono::milliseconds(1),
+                           uint32_t spins = 10);
+
+    void idle(size_t work);
+    void reset();
+    void wake();
+
+private:
+    std::chrono::nanoseconds m_minSleep;
+    std::chrono::nanoseconds m_maxSleep;
+    std::chrono::nanoseconds m_sleep;
+    uint32_t m_spins;
+    uint32_t m_count;
+};
+
+
+
+inline wakeup_signal::wakeup_signal()
+    :
+    m_sequence(0),
+    m_parked(0)
+{ }
+
+
+inline void wakeup_signal::notify()
+{
+    m_sequence.fetch_add(1, std::memory_order_seq_cst);
+    // A parking worker counts itself before re-checking the sequence, one of the two sides sees the other
+    if (m_parked.load(std::memory_order_seq_cst) != 0)
+    {
+        futex::wakeOne(m_sequence);
+    }
+}
+
+
+inline void wakeup_signal::notifyAll()
+{
+    m_sequence.fetch_add(1, std::memory_order_seq_cst);
+    if (m_parked.load(std::memory_order_seq_cst) != 0)
+    {
+        futex::wakeAll(m_sequence);
+    }
+}
+
+
+inline uint32_t wakeup_signal::sequence() const
+{
+    return m_sequence.load(std::memory_order_acquire);
+}
+
+
+inline void wakeup_signal::park(uint32_t seen)
+{
+    m_parked.fetch_add(1, std::memory_order_seq_cst);
+    if (m_sequence.load(std::memory_order_seq_cst) == seen)
+    {
+        futex::wait(m_sequence, seen);
+    }
+    m_parked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+
+
+inline void busy_spin::idle(size_t work)
+{
+    if (work == 0)
+    {
+        pause();
+    }
+}
+
+
+inline void busy_spin::reset()
+{ }
+
+
+inline void busy_spin::wake()
+{ }
+
+
+
+inline spin_yield::spin_yield(uint32_t spins)
+    :
+    m_spins(spins),
+    m_count(0)
+{ }
+
+
+inline void spin_yield::idle(size_t work)
+{
+    if (work != 0)
+    {
+        m_count = 0;
+        return;
+    }
+
+    if (m_count < m_spins)
+    {
+        ++m_count;
+        pause();
+    }
+    else
+    {
+        std::this_thread::yield();
+    }
+}
+
+
+inline void spin_yield::reset()
+{
+    m_count = 0;
+}
+
+
+inline void spin_yield::wake()
+{ }
+
+
+
+inline spin_park::spin_park(wakeup_signal& wakeup, uint32_t spins, uint32_t yields)
+    :
+    m_signal(&wakeup),
+    m_spins(spins),
+    m_yields(yields),
+    m_count(0),
+    m_seen(wakeup.sequence())
+{ }
+
+
+inline void spin_park::idle(size_t work)
+{
+    if (work != 0)
+    {
+        m_count = 0;
+    }
+    else if (m_count < m_spins)
+    {
+        ++m_count;
+        pause();
+    }
+    else if (m_count < m_spins + m_yields)
+    {
+        ++m_count;
+        std::this_thread::yield();
+    }
+    else
+    {
+        // Returns at once if notified since the sequence was taken, before the empty poll
+        m_signal->park(m_seen);
+    }
+
+    m_seen = m_signal->sequence();
+}
+
+
+inline void spin_park::reset()
+{
+    m_count = 0;
+    m_seen = m_signal->sequence();
+}
+
+
+inline void spin_park::wake()
+{
+    m_signal->notifyAll();
+}
+
+
+
+inline backoff_sleep::backoff_sleep(std::chrono::nanoseconds minSleep, std::chrono::nanoseconds maxSleep, uint32_t spins)
+    :
+    m_minSleep(minSleep),
+    m_maxSleep(maxSleep),
+    m_sleep(minSleep),
+    m_spins(spins),
+    m_count(0)
+{ }
+
+
+inline void backoff_sleep::idle(size_t work)
+{
+    if (work != 0)
+    {
+        reset();
+    }
+    else if (m_count < m_spins)
+    {
+        ++m_count;
+        pause();
+    }
+    else
+    {
+        std::this_thread::sleep_for(m_sleep);
+        m_sleep = m_sleep * 2 < m_maxSleep ? m_sleep * 2 : m_maxSleep;
+    }
+}
+
+
+inline void backoff_sleep::reset()
+{
+    m_count = 0;
+    m_sleep = m_minSleep;
+}
+
+
+// The sleep is bounded by maxSleep, the next idle() call sees the stop request
+inline void backoff_sleep::wake()
+{ }
+
+
+} // namespace idle
+} // namespace OSCompatible
+
+
+#endif //__idle_strategy__
@@ -0,0 +1,252 @@
+/**
+ * @file percpu_shared_mutex.hpp
+ *
+ * @brief Reader-writer lock for read-mostly data with distributed reader
+ * indicators: each reader counts itself on the cache line of its CPU, so
+ * readers of different cores never share a line, and a writer scans all the
+ * lines for the readers to leave.
+ *
+ * std::shared_mutex counts all the readers in a single word, whose cache line
+ * bounces between the cores (and sockets) even when no writer comes.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __percpu_shared_mutex__
+#define __percpu_shared_mutex__
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "OSCompatible/futex.hpp"
+#include "OSCompatible/idle_strategy.hpp"
+
+#ifdef _WIN32       // Windows
+#include <windows.h>
+#else               // Linux
+#include <sched.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief SharedLockable reader-writer lock with one reader indicator per CPU,
+ * usable with std::shared_lock, std::unique_lock and std::lock_guard.
+ *
+ * A thread keeps the indicator of the CPU it first took a shared lock on,
+ * pinned threads use the line of their own CPU. Writers are preferred: once a
+ * writer announced itself, new readers wait until it is done.
+ *
+ * @note Taking a writer lock costs a scan of one cache line per CPU, keep it
+ * for read-mostly data.
+ *
+ * @code
+ * OSCompatible::percpu_shared_mutex routesMutex;
+ *
+ * // Readers, on every message
+ * std::shared_lock<OSCompatible::percpu_shared_mutex> lock(routesMutex);
+ * auto route = routes.find(key);
+ *
+ * // Writer, on updates
+ * std::lock_guard<OSCompatible::percpu_shared_mutex> lock(routesMutex);
+ * routes[key] = route;
+ * @endcode
+ */
+class percpu_shared_mutex
+{
+public:
+    // Reader indicators, 0 for one per online CPU
+    explicit percpu_shared_mutex(size_t indicators = 0);
+
+    percpu_shared_mutex(const percpu_shared_mutex&) = delete;
+    percpu_shared_mutex& operator=(const percpu_shared_mutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    void lock_shared();
+    bool try_lock_shared();
+    void unlock_shared();
+
+private:
+    static constexpr uint32_t READER_SPINS = 1000;  // Pause instructions before a reader parks behind a writer
+
+    struct alignas(64) Indicator
+    {
+        std::atomic<uint64_t> readers{0};
+    };
+
+    // Indicator of the calling thread, the CPU it ran on at its first shared lock
+    size_t Index() const;
+    bool ReadersLeft() const;
+    void WaitForWriter();
+
+    std::vector<Indicator> m_indicators;
+    alignas(64) std::atomic<uint32_t> m_writer;     // 1 while a writer holds or waits for the lock
+    std::atomic<uint32_t> m_parked;                 // Readers asleep behind the writer
+    std::mutex m_writers;                           // Serializes the writers, parks them while one waits for the readers
+};
+
+
+
+inline percpu_shared_mutex::percpu_shared_mutex(size_t indicators)
+    :
+    m_indicators(indicators != 0 ? indicators : (std::thread::hardware_concurrency() != 0 ? std::thread::hardware_concurrency() : 1)),
+    m_writer(0),
+    m_parked(0),
+    m_writers()
+{ }
+
+
+inline size_t percpu_shared_mutex::Index() const
+{
+    thread_local long cpu = -1;
+    if (cpu < 0)
+    {
+#ifdef _WIN32
+        cpu = static_cast<long>(GetCurrentProcessorNumber());
+#else
+        cpu = sched_getcpu();
+        cpu = cpu < 0 ? 0 : cpu;
+#endif
+    }
+    return static_cast<size_t>(cpu) % m_indicators.size();
+}
+
+
+inline bool percpu_shared_mutex::ReadersLeft() const
+{
+    for (const Indicator& indicator : m_indicators)
+    {
+        if (indicator.readers.load(std::memory_order_seq_cst) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+inline void percpu_shared_mutex::WaitForWriter()
+{
+    for (uint32_t spin = 0; spin < READER_SPINS; ++spin)
+    {
+        if (m_writer.load(std::memory_order_acquire) == 0)
+        {
+            return;
+        }
+        idle::pause();
+    }
+
+    // The writer counts the parked readers after clearing m_writer, one of the two sides sees the other
+    m_parked.fetch_add(1, std::memory_order_seq_cst);
+    while (m_writer.load(std::memory_order_seq_cst) != 0)
+    {
+        futex::wait(m_writer, 1);
+    }
+    m_parked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+
+inline void percpu_shared_mutex::lock_shared()
+{
+    std::atomic<uint64_t>& readers = m_indicators[Index()].readers;
+
+    for (;;)
+    {
+        // Announce first, then check for a writer: a writer sets m_writer first, then scans
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        if (m_writer.load(std::memory_order_seq_cst) == 0)
+        {
+            return;
+        }
+
+        readers.fetch_sub(1, std::memory_order_release);
+        WaitForWriter();
+    }
+}
+
+
+inline bool percpu_shared_mutex::try_lock_shared()
+{
+    std::atomic<uint64_t>& readers = m_indicators[Index()].readers;
+
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    if (m_writer.load(std::memory_order_seq_cst) == 0)
+    {
+        return true;
+    }
+    readers.fetch_sub(1, std::memory_order_release);
+    return false;
+}
+
+
+inline void percpu_shared_mutex::unlock_shared()
+{
+    m_indicators[Index()].readers.fetch_sub(1, std::memory_order_release);
+}
+
+
+inline void percpu_shared_mutex::lock()
+{
+    m_writers.lock();
+    m_writer.store(1, std::memory_order_seq_cst);
+
+    // Readers inside finish, the new ones back off
+    uint32_t spin = 0;
+    while (!ReadersLeft())
+    {
+        if (++spin < READER_SPINS)
+        {
+            idle::pause();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+inline bool percpu_shared_mutex::try_lock()
+{
+    if (!m_writers.try_lock())
+    {
+        return false;
+    }
+
+    m_writer.store(1, std::memory_order_seq_cst);
+    if (ReadersLeft())
+    {
+        return true;
+    }
+
+    unlock();
+    return false;
+}
+
+
+inline void percpu_shared_mutex::unlock()
+{
+    m_writer.store(0, std::memory_order_seq_cst);
+    if (m_parked.load(std::memory_order_seq_cst) != 0)
+    {
+        futex::wakeAll(m_writer);
+    }
+    m_writers.unlock();
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__percpu_shared_mutex__
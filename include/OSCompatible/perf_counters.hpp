@@ -0,0 +1,445 @@
+/**
+ * @file perf_counters.hpp
+ *
+ * @brief Per-thread hardware and software performance counters (perf_event_open):
+ * cycles, instructions, cache misses, branch misses, CPU migrations, page
+ * faults and context switches, to prove that pinning improved IPC and cache
+ * behaviour in production.
+ *
+ * Hardware events missing on the host (VMs, containers, restrictive
+ * perf_event_paranoid) are skipped and only the available events count.
+ * The monitored thread can read its counters with rdpmc from the mmap'd
+ * event page, without a syscall, where the kernel permits it.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __perf_counters__
+#define __perf_counters__
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Performance counters of a single thread.
+ *
+ * Created for a thread at spawn by setting Properties::perfCounters (then
+ * available with thread::counters() and, inside the thread,
+ * perf_counters::current()), or directly for any thread of the process.
+ *
+ * @note Linux only, on Windows no event is available.
+ */
+class perf_counters
+{
+public:
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        CPU_MIGRATIONS,     // software
+        PAGE_FAULTS,        // software
+        CONTEXT_SWITCHES,   // software
+        EVENTS_COUNT
+    };
+
+    struct Values
+    {
+        uint64_t value[EVENTS_COUNT];   // Scaled by the time the event was counting when multiplexed
+        bool available[EVENTS_COUNT];   // The event could be opened on this host
+
+        // Instructions per cycle, 0 if the hardware events are not available
+        double ipc() const
+        {
+            return available[CYCLES] && available[INSTRUCTIONS] && value[CYCLES] != 0
+                ? static_cast<double>(value[INSTRUCTIONS]) / static_cast<double>(value[CYCLES]) : 0.0;
+        }
+    };
+
+    /**
+     * @brief Opens the counters of a thread of this process, hardware events
+     * count user space only.
+     *
+     * @param tid Kernel thread id, 0 for the calling thread.
+     */
+    explicit perf_counters(long tid = 0);
+    ~perf_counters();
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    static const char* name(Event event);
+
+    // Reads all the counters (a read syscall per event)
+    Values read() const;
+
+    /**
+     * @brief Reads one counter, with rdpmc when called from the monitored
+     * thread and the kernel permits user space access (x86), falling back to
+     * the read syscall otherwise. Both paths scale a multiplexed event the
+     * same way.
+     */
+    uint64_t read(Event event) const;
+
+    bool available(Event event) const;
+
+    // At least one of the hardware events is available
+    bool hardwareAvailable() const;
+
+    void reset();
+    void enable();
+    void disable();
+
+    // Counters opened at spawn for the calling OSCompatible thread, nullptr if none
+    static const std::shared_ptr<perf_counters>& current();
+
+private:
+    friend class thread;
+
+    static std::shared_ptr<perf_counters>& Current();
+
+    // Kernel tid of the calling thread, cached: the comparison on each rdpmc read costs no gettid syscall
+    static long CurrentTid();
+
+    uint64_t ReadSyscall(Event event) const;
+
+    int m_fd[EVENTS_COUNT];
+    void* m_page[EVENTS_COUNT];     // perf_event_mmap_page of the hardware events (rdpmc)
+    long m_tid;                     // Kernel tid of the monitored thread
+};
+
+
+
+inline perf_counters::perf_counters(long tid)
+    :
+    m_tid(tid == 0 ? thread::CurrentTid() : tid)
+{
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        m_fd[event] = -1;
+        m_page[event] = nullptr;
+    }
+
+#ifndef _WIN32
+    struct EventConfig
+    {
+        uint32_t type;
+        uint64_t config;
+    };
+    const EventConfig configs[EVENTS_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    };
+
+    const long pageSize = sysconf(_SC_PAGESIZE);
+
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = configs[event].type;
+        attr.config = configs[event].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_hv = 1;
+        // Hardware events count user space only (allowed with perf_event_paranoid 2),
+        // software events like context switches happen in the kernel
+        attr.exclude_kernel = attr.type == PERF_TYPE_HARDWARE ? 1 : 0;
+
+        // pid is the tid of the thread, any CPU it runs on
+        long fd = syscall(SYS_perf_event_open, &attr, static_cast<pid_t>(m_tid), -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0 && !attr.exclude_kernel)
+        {
+            attr.exclude_kernel = 1;
+            fd = syscall(SYS_perf_event_open, &attr, static_cast<pid_t>(m_tid), -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+        if (fd < 0)
+        {
+            continue; // not available on this host, count the other events
+        }
+        m_fd[event] = static_cast<int>(fd);
+
+        if (attr.type == PERF_TYPE_HARDWARE)
+        {
+            void* page = mmap(nullptr, static_cast<size_t>(pageSize), PROT_READ, MAP_SHARED, m_fd[event], 0);
+            m_page[event] = page == MAP_FAILED ? nullptr : page;
+        }
+    }
+#endif
+}
+
+
+inline perf_counters::~perf_counters()
+{
+#ifndef _WIN32
+    const long pageSize = sysconf(_SC_PAGESIZE);
+
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        if (m_page[event] != nullptr)
+        {
+            munmap(m_page[event], static_cast<size_t>(pageSize));
+        }
+        if (m_fd[event] >= 0)
+        {
+            close(m_fd[event]);
+        }
+    }
+#endif
+}
+
+
+inline const char* perf_counters::name(Event event)
+{
+    switch (event)
+    {
+        case CYCLES:            return "cycles";
+        case INSTRUCTIONS:      return "instructions";
+        case CACHE_MISSES:      return "cache-misses";
+        case BRANCH_MISSES:     return "branch-misses";
+        case CPU_MIGRATIONS:    return "cpu-migrations";
+        case PAGE_FAULTS:       return "page-faults";
+        case CONTEXT_SWITCHES:  return "context-switches";
+        default:                return "unknown";
+    }
+}
+
+
+inline bool perf_counters::available(Event event) const
+{
+    return m_fd[event] >= 0;
+}
+
+
+inline bool perf_counters::hardwareAvailable() const
+{
+    return available(CYCLES) || available(INSTRUCTIONS) || available(CACHE_MISSES) || available(BRANCH_MISSES);
+}
+
+
+inline long perf_counters::CurrentTid()
+{
+    thread_local long tid = thread::CurrentTid();
+    return tid;
+}
+
+
+inline uint64_t perf_counters::ReadSyscall(Event event) const
+{
+#ifndef _WIN32
+    if (m_fd[event] < 0)
+    {
+        return 0;
+    }
+
+    uint64_t data[3] = {0, 0, 0}; // value, time enabled, time running
+    if (::read(m_fd[event], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+    {
+        return 0;
+    }
+
+    // Scale when the PMU was multiplexed between more events than counters
+    if (data[2] != 0 && data[2] < data[1])
+    {
+        return static_cast<uint64_t>(static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]));
+    }
+    return data[0];
+#else
+    (void)event;
+    return 0;
+#endif
+}
+
+
+inline uint64_t perf_counters::read(Event event) const
+{
+#if !defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
+    auto* page = static_cast<volatile perf_event_mmap_page*>(m_page[event]);
+
+    if (page != nullptr && m_tid == CurrentTid())
+    {
+        // Self-monitoring user space read, retried while the kernel updates the page
+        for (int attempt = 0; attempt < 16; ++attempt)
+        {
+            uint32_t sequence = page->lock;
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+            uint32_t index = page->index;
+            if (!page->cap_user_rdpmc || index == 0)
+            {
+                break; // not permitted or the event is not scheduled now
+            }
+
+            uint64_t enabled = page->time_enabled;
+            uint64_t running = page->time_running;
+            uint64_t cycles = 0;
+            uint64_t timeOffset = 0;
+            uint32_t timeMult = 0;
+            uint16_t timeShift = 0;
+            if (enabled != running)
+            {
+                if (!page->cap_user_time)
+                {
+                    break; // multiplexed and no way to extend the times to now, the syscall scales
+                }
+                uint32_t low, high;
+                __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+                cycles = (static_cast<uint64_t>(high) << 32) | low;
+                timeOffset = page->time_offset;
+                timeMult = page->time_mult;
+                timeShift = page->time_shift;
+            }
+
+            int64_t count = page->offset;
+            uint32_t low, high;
+            __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index - 1));
+            int64_t pmc = static_cast<int64_t>((static_cast<uint64_t>(high) << 32) | low);
+
+            // Sign extend the pmc_width bits counter
+            uint16_t width = page->pmc_width;
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            if (page->lock != sequence)
+            {
+                continue;
+            }
+
+            // Multiplexed: scale like ReadSyscall, with both times extended to now
+            // (the event is scheduled, it has been running since the page update)
+            if (enabled != running)
+            {
+                const uint64_t quotient = cycles >> timeShift;
+                const uint64_t remainder = cycles & ((static_cast<uint64_t>(1) << timeShift) - 1);
+                const uint64_t delta = timeOffset + quotient * timeMult + ((remainder * timeMult) >> timeShift);
+                enabled += delta;
+                running += delta;
+                if (running != 0 && running < enabled)
+                {
+                    return static_cast<uint64_t>(static_cast<double>(count) * static_cast<double>(enabled) / static_cast<double>(running));
+                }
+            }
+            return static_cast<uint64_t>(count);
+        }
+    }
+#endif
+
+    return ReadSyscall(event);
+}
+
+
+inline perf_counters::Values perf_counters::read() const
+{
+    Values values;
+
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        values.available[event] = available(static_cast<Event>(event));
+        values.value[event] = ReadSyscall(static_cast<Event>(event));
+    }
+    return values;
+}
+
+
+inline void perf_counters::reset()
+{
+#ifndef _WIN32
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        if (m_fd[event] >= 0)
+        {
+            ioctl(m_fd[event], PERF_EVENT_IOC_RESET, 0);
+        }
+    }
+#endif
+}
+
+
+inline void perf_counters::enable()
+{
+#ifndef _WIN32
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        if (m_fd[event] >= 0)
+        {
+            ioctl(m_fd[event], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+
+inline void perf_counters::disable()
+{
+#ifndef _WIN32
+    for (int event = 0; event < EVENTS_COUNT; ++event)
+    {
+        if (m_fd[event] >= 0)
+        {
+            ioctl(m_fd[event], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+}
+
+
+inline std::shared_ptr<perf_counters>& perf_counters::Current()
+{
+    thread_local std::shared_ptr<perf_counters> counters;
+    return counters;
+}
+
+
+inline const std::shared_ptr<perf_counters>& perf_counters::current()
+{
+    return Current();
+}
+
+
+
+// Performance counters of the thread class
+
+inline void thread::OpenPerfCounters()
+{
+    perf_counters::Current() = std::make_shared<perf_counters>();
+    m_counters = perf_counters::Current();
+}
+
+
+inline std::shared_ptr<perf_counters> thread::counters() const
+{
+    return m_counters;
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__perf_counters__
@@ -0,0 +1,258 @@
+/**
+ * @file periodic_thread.hpp
+ *
+ * @brief Fixed-rate loop on an OSCompatible thread: the callback runs at
+ * absolute deadlines of CLOCK_MONOTONIC (clock_nanosleep TIMER_ABSTIME), so
+ * the loop doesn't drift like sleep_for based loops, optionally spinning over
+ * the last microseconds before each deadline, with overrun policies and
+ * wakeup latency statistics.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __periodic_thread__
+#define __periodic_thread__
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/histogram.hpp"
+#include "OSCompatible/idle_strategy.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Runs a callback every period on a thread created with the given
+ * properties.
+ *
+ * @code
+ * OSCompatible::periodic_thread::Options options;
+ * options.spin = std::chrono::microseconds(20);
+ * OSCompatible::periodic_thread control(rtProperties, std::chrono::milliseconds(1), controlStep, options);
+ * ...
+ * control.stop();
+ * std::cout << control.latency().percentile(99.0) << "ns p99 wakeup latency" << std::endl;
+ * @endcode
+ */
+class periodic_thread
+{
+public:
+    // What to do when the callback runs past the next deadline
+    enum class Overrun
+    {
+        skip,       // Drop the missed periods, continue at the next future deadline
+        catchUp     // Run the missed periods back to back until on schedule again
+    };
+
+    struct Options
+    {
+        std::chrono::nanoseconds spin{0};   // Busy wait over the last part of each period instead of sleeping
+        Overrun overrun = Overrun::skip;
+    };
+
+    /**
+     * @brief Starts the loop, the first deadline is one period from now.
+     *
+     * @throw std::runtime_error if the thread can't be created with the properties.
+     */
+    template <typename Callback>
+    periodic_thread(const thread::Properties& properties, std::chrono::nanoseconds period,
+                    Callback&& callback, const Options& options = Options());
+
+    // Stops the loop and joins the thread
+    ~periodic_thread();
+
+    periodic_thread(const periodic_thread&) = delete;
+    periodic_thread& operator=(const periodic_thread&) = delete;
+
+    /**
+     * @brief Stops the loop after the running period and joins the thread.
+     *
+     * @note Waits up to one period (the loop sleeps until its next deadline).
+     */
+    void stop();
+
+    // Periods run so far
+    uint64_t iterations() const;
+
+    // Periods whose callback ended after the next deadline
+    uint64_t overruns() const;
+
+    // Periods dropped by the skip policy
+    uint64_t skipped() const;
+
+    // Wakeup latency (actual wakeup - deadline) in ns, recorded by the loop thread
+    const histogram& latency() const;
+
+private:
+    void Run();
+
+    static int64_t Now();
+    static void SleepUntil(int64_t deadlineNs);
+
+    std::chrono::nanoseconds m_period;
+    Options m_options;
+    std::function<void()> m_callback;
+    std::atomic<bool> m_stop;
+    std::atomic<uint64_t> m_iterations;
+    std::atomic<uint64_t> m_overruns;
+    std::atomic<uint64_t> m_skipped;
+    std::unique_ptr<histogram> m_latency;   // Large, kept off the owner stack
+    std::unique_ptr<thread> m_thread;
+};
+
+
+
+template <typename Callback>
+periodic_thread::periodic_thread(const thread::Properties& properties, std::chrono::nanoseconds period,
+                                 Callback&& callback, const Options& options)
+    :
+    m_period(period),
+    m_options(options),
+    m_callback(std::forward<Callback>(callback)),
+    m_stop(false),
+    m_iterations(0),
+    m_overruns(0),
+    m_skipped(0),
+    m_latency(std::make_unique<histogram>()),
+    m_thread()
+{
+    if (m_period.count() <= 0)
+    {
+        throw std::runtime_error("Failed to start periodic thread: period must be positive");
+    }
+
+    m_thread = std::make_unique<thread>(properties, &periodic_thread::Run, this);
+}
+
+
+inline periodic_thread::~periodic_thread()
+{
+    stop();
+}
+
+
+inline void periodic_thread::stop()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+
+    if (m_thread && m_thread->joinable())
+    {
+        m_thread->join();
+    }
+}
+
+
+inline uint64_t periodic_thread::iterations() const
+{
+    return m_iterations.load(std::memory_order_relaxed);
+}
+
+
+inline uint64_t periodic_thread::overruns() const
+{
+    return m_overruns.load(std::memory_order_relaxed);
+}
+
+
+inline uint64_t periodic_thread::skipped() const
+{
+    return m_skipped.load(std::memory_order_relaxed);
+}
+
+
+inline const histogram& periodic_thread::latency() const
+{
+    return *m_latency;
+}
+
+
+inline int64_t periodic_thread::Now()
+{
+#ifdef _WIN32
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+#endif
+}
+
+
+inline void periodic_thread::SleepUntil(int64_t deadlineNs)
+{
+#ifndef _WIN32
+    struct timespec deadline;
+    deadline.tv_sec = static_cast<time_t>(deadlineNs / 1000000000LL);
+    deadline.tv_nsec = static_cast<long>(deadlineNs % 1000000000LL);
+
+    // Absolute deadline, an interrupted sleep resumes without drifting
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+    { }
+#else
+    const int64_t remaining = deadlineNs - Now();
+    if (remaining > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
+    }
+#endif
+}
+
+
+inline void periodic_thread::Run()
+{
+    const int64_t period = m_period.count();
+    const int64_t spin = m_options.spin.count();
+    int64_t next = Now() + period;
+
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        SleepUntil(next - spin);
+
+        // Pause between the clock reads, the SMT sibling keeps its share of the core
+        int64_t now = Now();
+        while (now < next)
+        {
+            idle::pause();
+            now = Now();
+        }
+
+        m_latency->record(now - next);
+        m_callback();
+        m_iterations.fetch_add(1, std::memory_order_relaxed);
+
+        next += period;
+
+        const int64_t end = Now();
+        if (end > next)
+        {
+            m_overruns.fetch_add(1, std::memory_order_relaxed);
+
+            if (m_options.overrun == Overrun::skip)
+            {
+                // Continue at the first deadline still in the future
+                const int64_t missed = (end - next) / period + 1;
+                next += missed * period;
+                m_skipped.fetch_add(static_cast<uint64_t>(missed), std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__periodic_thread__
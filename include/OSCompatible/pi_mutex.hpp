@@ -0,0 +1,278 @@
+/**
+ * @file pi_mutex.hpp
+ *
+ * @brief Priority-inheritance mutex for locks shared between real-time
+ * (SCHED_FIFO/SCHED_RR) and normal threads: the owner runs at the priority of
+ * its highest waiter until it unlocks (PTHREAD_PRIO_INHERIT, FUTEX_LOCK_PI in
+ * the kernel), so a medium priority thread can't keep a high priority waiter
+ * blocked behind a preempted low priority owner.
+ *
+ * Optional instrumentation records the inversions: waits of a thread on an
+ * owner of lower priority, with their duration.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __pi_mutex__
+#define __pi_mutex__
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/histogram.hpp"
+
+#ifdef _WIN32       // Windows
+#include <windows.h>
+#else               // Linux
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Lockable priority-inheritance mutex, usable with std::lock_guard and
+ * std::unique_lock.
+ *
+ * @note Windows has no priority inheritance (its scheduler boosts starving
+ * threads instead), the mutex is a plain one there, instrumentation included.
+ *
+ * @code
+ * OSCompatible::pi_mutex mutex(true);     // instrumented
+ * ...
+ * std::lock_guard<OSCompatible::pi_mutex> lock(mutex);
+ * ...
+ * std::cout << mutex.inversions() << " inversions, " << mutex.inversionWait().summary().format() << std::endl;
+ * @endcode
+ */
+class pi_mutex
+{
+public:
+    /**
+     * @param instrument Record the inversions, costs a scheduler query per
+     * acquisition and a histogram.
+     *
+     * @throw std::runtime_error if the mutex can't be created.
+     */
+    explicit pi_mutex(bool instrument = false);
+    ~pi_mutex();
+
+    pi_mutex(const pi_mutex&) = delete;
+    pi_mutex& operator=(const pi_mutex&) = delete;
+
+    /**
+     * @throw std::runtime_error if the kernel refuses the lock (e.g. a
+     * deadlock detected by the PI chain walk).
+     */
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    // Acquisitions that had to wait, 0 when not instrumented
+    uint64_t contentions() const;
+
+    // Waits on an owner of lower priority than the waiter, 0 when not instrumented
+    uint64_t inversions() const;
+
+    // Duration (ns) of the inversions, empty when not instrumented
+    const histogram& inversionWait() const;
+
+    // Tid of the owner, 0 when unlocked or not instrumented
+    long owner() const;
+
+private:
+    struct Instrumentation
+    {
+        std::atomic<long> owner{0};
+        std::atomic<int> ownerPriority{0};
+        std::atomic<uint64_t> contentions{0};
+        std::atomic<uint64_t> inversions{0};
+        histogram inversionWait;
+    };
+
+    // Scheduling priority of the calling thread, real-time priorities above 0, normal threads at 0 (Linux)
+    static int CurrentPriority();
+    static long CurrentTid();
+    void Acquired();
+
+#ifdef _WIN32
+    std::mutex m_mutex;
+#else
+    pthread_mutex_t m_mutex;
+#endif
+    std::unique_ptr<Instrumentation> m_instrumentation;
+};
+
+
+
+inline pi_mutex::pi_mutex(bool instrument)
+    :
+    m_mutex(),
+    m_instrumentation(instrument ? std::make_unique<Instrumentation>() : nullptr)
+{
+#ifndef _WIN32
+    pthread_mutexattr_t attributes;
+    int error = pthread_mutexattr_init(&attributes);
+    if (error == 0)
+    {
+        error = pthread_mutexattr_setprotocol(&attributes, PTHREAD_PRIO_INHERIT);
+        if (error == 0)
+        {
+            error = pthread_mutex_init(&m_mutex, &attributes);
+        }
+        pthread_mutexattr_destroy(&attributes);
+    }
+
+    if (error != 0)
+    {
+        throw std::runtime_error("Failed to create priority inheritance mutex: " + std::string(strerror(error)));
+    }
+#endif
+}
+
+
+inline pi_mutex::~pi_mutex()
+{
+#ifndef _WIN32
+    pthread_mutex_destroy(&m_mutex);
+#endif
+}
+
+
+inline int pi_mutex::CurrentPriority()
+{
+#ifdef _WIN32
+    return GetThreadPriority(GetCurrentThread());
+#else
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+    {
+        return 0;
+    }
+    return (policy == SCHED_FIFO || policy == SCHED_RR) ? param.sched_priority : 0;
+#endif
+}
+
+
+inline long pi_mutex::CurrentTid()
+{
+    thread_local long tid = thread::CurrentTid();
+    return tid;
+}
+
+
+inline void pi_mutex::Acquired()
+{
+    m_instrumentation->owner.store(CurrentTid(), std::memory_order_relaxed);
+    m_instrumentation->ownerPriority.store(CurrentPriority(), std::memory_order_relaxed);
+}
+
+
+inline bool pi_mutex::try_lock()
+{
+#ifdef _WIN32
+    const bool locked = m_mutex.try_lock();
+#else
+    const bool locked = pthread_mutex_trylock(&m_mutex) == 0;
+#endif
+    if (locked && m_instrumentation)
+    {
+        Acquired();
+    }
+    return locked;
+}
+
+
+inline void pi_mutex::lock()
+{
+    if (m_instrumentation && try_lock())
+    {
+        return;
+    }
+
+    // Contended: the owner priority is its base one, inheritance boosts it only once this thread waits
+    const int waiterPriority = m_instrumentation ? CurrentPriority() : 0;
+    const int ownerPriority = m_instrumentation ? m_instrumentation->ownerPriority.load(std::memory_order_relaxed) : 0;
+    const auto begin = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+    m_mutex.lock();
+#else
+    const int error = pthread_mutex_lock(&m_mutex);
+    if (error != 0)
+    {
+        throw std::runtime_error("Failed to lock priority inheritance mutex: " + std::string(strerror(error)));
+    }
+#endif
+
+    if (m_instrumentation)
+    {
+        m_instrumentation->contentions.fetch_add(1, std::memory_order_relaxed);
+        if (waiterPriority > ownerPriority)
+        {
+            m_instrumentation->inversions.fetch_add(1, std::memory_order_relaxed);
+            m_instrumentation->inversionWait.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - begin).count());
+        }
+        Acquired();
+    }
+}
+
+
+inline void pi_mutex::unlock()
+{
+    if (m_instrumentation)
+    {
+        m_instrumentation->owner.store(0, std::memory_order_relaxed);
+    }
+
+#ifdef _WIN32
+    m_mutex.unlock();
+#else
+    pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+
+inline uint64_t pi_mutex::contentions() const
+{
+    return m_instrumentation ? m_instrumentation->contentions.load(std::memory_order_relaxed) : 0;
+}
+
+
+inline uint64_t pi_mutex::inversions() const
+{
+    return m_instrumentation ? m_instrumentation->inversions.load(std::memory_order_relaxed) : 0;
+}
+
+
+inline const histogram& pi_mutex::inversionWait() const
+{
+    static const histogram empty;
+    return m_instrumentation ? m_instrumentation->inversionWait : empty;
+}
+
+
+inline long pi_mutex::owner() const
+{
+    return m_instrumentation ? m_instrumentation->owner.load(std::memory_order_relaxed) : 0;
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__pi_mutex__
@@ -0,0 +1,573 @@
+/**
+ * @file profile.hpp
+ *
+ * @brief Named thread profiles ("ingest", "matcher", "gc"...) loaded from a
+ * config file or environment variable, so thread placement can be retuned per
+ * host without a recompile.
+ *
+ * Profile definitions, one per line (or separated by ';'), '#' starts a comment:
+ *
+ *     ingest:  policy=fifo priority=50 cpus=2-3 stack=256K
+ *     matcher: policy=rr priority=40 cpus=4-7 numa=0 util_min=1024
+ *     gc:      policy=idle nice=19 io_class=idle timer_slack=5000000
+ *
+ * Threads are named after their profile.
+ *
+ * Keys: policy (default|other|fifo|rr|batch|idle), priority, cpus (CPU list),
+ * numa (node, also the default cpus), stack (bytes, K/M/G suffix), nice,
+ * io_class (rt|be|idle), io_level, timer_slack (ns), util_min, util_max,
+ * perf (on|off, performance counters at spawn), sampling (profiler period in
+ * microseconds of thread CPU time).
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __profile__
+#define __profile__
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/cpulist.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Named set of thread properties with the native thread attributes
+ * built once from them.
+ *
+ * Profiles are kept in a process-wide registry, filled by define(), load(),
+ * loadDefinitions() or loadFromEnvironment() at startup, and resolved by name
+ * with find(). Redefining a profile replaces it for the following lookups,
+ * profiles already resolved stay valid.
+ *
+ * @code
+ * OSCompatible::profile::loadFromEnvironment();
+ * OSCompatible::thread t("ingest", ingestLoop);
+ * @endcode
+ */
+class profile
+{
+public:
+    static const char* const ENVIRONMENT_VARIABLE;      // Inline profile definitions
+    static const char* const ENVIRONMENT_FILE_VARIABLE; // Path to a profiles file
+
+
+    /**
+     * @brief Builds the profile and its native thread attributes.
+     *
+     * @throws std::runtime_error If the attributes can't be built from the properties.
+     */
+    profile(const std::string& name, const thread::Properties& properties);
+    ~profile();
+
+    profile(const profile&) = delete;
+    profile& operator=(const profile&) = delete;
+
+    const std::string& name() const;
+    const thread::Properties& properties() const;
+
+
+    /**
+     * @brief Adds (or replaces) a profile in the registry.
+     *
+     * @return The registered profile.
+     * @throws std::runtime_error If the attributes can't be built from the properties.
+     */
+    static std::shared_ptr<const profile> define(const std::string& name, const thread::Properties& properties);
+
+    /**
+     * @brief Defines the profiles of a definitions text (see the file header
+     * for the format).
+     *
+     * @throws std::runtime_error On a malformed definition, nothing is defined then.
+     */
+    static void loadDefinitions(const std::string& definitions);
+
+    /**
+     * @brief Defines the profiles of a definitions file.
+     *
+     * @throws std::runtime_error If the file can't be read or is malformed.
+     */
+    static void load(const std::string& path);
+
+    /**
+     * @brief Loads the file named by OSCOMPATIBLE_PROFILES_FILE and then the
+     * inline definitions of OSCOMPATIBLE_PROFILES (overriding the file ones).
+     * Missing variables are ignored.
+     *
+     * @throws std::runtime_error If a definition is malformed.
+     */
+    static void loadFromEnvironment();
+
+    /**
+     * @brief Resolves a profile by name.
+     *
+     * @throws std::runtime_error If there is no profile with this name.
+     */
+    static std::shared_ptr<const profile> find(const std::string& name);
+
+    /**
+     * @brief Names of all the defined profiles.
+     */
+    static std::vector<std::string> names();
+
+    /**
+     * @brief Parses the "key=value key=value" part of a profile definition.
+     *
+     * @throws std::runtime_error On an unknown key or invalid value.
+     */
+    static thread::Properties parseProperties(const std::string& definition);
+
+
+private:
+    friend class thread;
+
+    const thread::nativeAttributes* attributes() const;
+
+    static int ParsePolicy(const std::string& value);
+    static int ParseIoClass(const std::string& value);
+    static size_t ParseSize(const std::string& value);
+    static long ParseNumber(const std::string& key, const std::string& value);
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<const profile>> profiles;
+    };
+    static Registry& GetRegistry();
+
+    std::string m_name;
+    thread::Properties m_properties;
+#ifndef _WIN32
+    pthread_attr_t m_attr;
+#endif
+};
+
+
+
+inline const char* const profile::ENVIRONMENT_VARIABLE = "OSCOMPATIBLE_PROFILES";
+inline const char* const profile::ENVIRONMENT_FILE_VARIABLE = "OSCOMPATIBLE_PROFILES_FILE";
+
+
+
+inline profile::profile(const std::string& name, const thread::Properties& properties)
+    :
+    m_name(name),
+    m_properties(properties)
+{
+    if (m_properties.name.empty())
+    {
+        m_properties.name = m_name; // threads are named after their profile
+    }
+
+#ifndef _WIN32
+    thread::InitAttributes(m_properties, &m_attr);
+#endif
+}
+
+
+inline profile::~profile()
+{
+#ifndef _WIN32
+    pthread_attr_destroy(&m_attr);
+#endif
+}
+
+
+inline const std::string& profile::name() const
+{
+    return m_name;
+}
+
+
+inline const thread::Properties& profile::properties() const
+{
+    return m_properties;
+}
+
+
+inline const thread::nativeAttributes* profile::attributes() const
+{
+#ifdef _WIN32
+    return nullptr; // windows sets the properties on the created thread
+#else
+    return &m_attr;
+#endif
+}
+
+
+inline profile::Registry& profile::GetRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+
+inline std::shared_ptr<const profile> profile::define(const std::string& name, const thread::Properties& properties)
+{
+    auto newProfile = std::make_shared<const profile>(name, properties);
+
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.profiles[name] = newProfile;
+
+    return newProfile;
+}
+
+
+inline void profile::loadDefinitions(const std::string& definitions)
+{
+    std::vector<std::pair<std::string, thread::Properties>> parsed;
+    std::string normalized = definitions;
+    std::replace(normalized.begin(), normalized.end(), ';', '\n');
+
+    std::istringstream stream(normalized);
+    std::string line;
+    size_t lineNumber = 0;
+
+    while (std::getline(stream, line))
+    {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue; // empty or comment line
+        }
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+        {
+            throw std::runtime_error("Invalid profile definition (line " + std::to_string(lineNumber) +
+                                     "): missing ':' after the profile name");
+        }
+
+        std::string name = line.substr(0, colon);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (name.empty())
+        {
+            throw std::runtime_error("Invalid profile definition (line " + std::to_string(lineNumber) +
+                                     "): empty profile name");
+        }
+
+        try
+        {
+            parsed.emplace_back(name, parseProperties(line.substr(colon + 1)));
+        }
+        catch (std::exception& e)
+        {
+            throw std::runtime_error("Invalid profile \"" + name + "\" (line " + std::to_string(lineNumber) +
+                                     "): " + e.what());
+        }
+    }
+
+    // Builds all the profiles first (their attributes can still be refused),
+    // then registers them at once
+    std::vector<std::shared_ptr<const profile>> profiles;
+    for (const auto& definition : parsed)
+    {
+        try
+        {
+            profiles.push_back(std::make_shared<const profile>(definition.first, definition.second));
+        }
+        catch (std::exception& e)
+        {
+            throw std::runtime_error("Invalid profile \"" + definition.first + "\": " + e.what());
+        }
+    }
+
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& newProfile : profiles)
+    {
+        registry.profiles[newProfile->name()] = newProfile;
+    }
+}
+
+
+inline void profile::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open profiles file: " + path);
+    }
+
+    std::stringstream content;
+    content << file.rdbuf();
+    loadDefinitions(content.str());
+}
+
+
+inline void profile::loadFromEnvironment()
+{
+    const char* path = std::getenv(ENVIRONMENT_FILE_VARIABLE);
+    if (path != nullptr && *path != '\0')
+    {
+        load(path);
+    }
+
+    const char* definitions = std::getenv(ENVIRONMENT_VARIABLE);
+    if (definitions != nullptr)
+    {
+        loadDefinitions(definitions);
+    }
+}
+
+
+inline std::shared_ptr<const profile> profile::find(const std::string& name)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto it = registry.profiles.find(name);
+    if (it == registry.profiles.end())
+    {
+        throw std::runtime_error("Unknown thread profile: " + name);
+    }
+    return it->second;
+}
+
+
+inline std::vector<std::string> profile::names()
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    std::vector<std::string> result;
+    for (const auto& entry : registry.profiles)
+    {
+        result.push_back(entry.first);
+    }
+    return result;
+}
+
+
+inline thread::Properties profile::parseProperties(const std::string& definition)
+{
+    thread::Properties properties = thread::DEFAULT_PROPERTIES;
+    bool cpusDefined = false;
+
+    std::istringstream stream(definition);
+    std::string token;
+
+    while (stream >> token)
+    {
+        size_t equal = token.find('=');
+        if (equal == std::string::npos || equal == 0 || equal + 1 == token.size())
+        {
+            throw std::runtime_error("expected key=value, got \"" + token + "\"");
+        }
+
+        std::string key = token.substr(0, equal);
+        std::string value = token.substr(equal + 1);
+
+        if (key == "policy")
+        {
+            properties.policy = ParsePolicy(value);
+        }
+        else if (key == "priority")
+        {
+            properties.priority = static_cast<int>(ParseNumber(key, value));
+        }
+        else if (key == "cpus")
+        {
+            properties.affinity = cpulist::parse(value);
+            cpusDefined = true;
+        }
+        else if (key == "numa")
+        {
+            properties.numaNode = static_cast<int>(ParseNumber(key, value));
+        }
+        else if (key == "stack")
+        {
+            properties.stackSize = ParseSize(value);
+        }
+        else if (key == "nice")
+        {
+            properties.nice = static_cast<int>(ParseNumber(key, value));
+        }
+        else if (key == "io_class")
+        {
+            properties.ioPriorityClass = ParseIoClass(value);
+        }
+        else if (key == "io_level")
+        {
+            properties.ioPriorityLevel = static_cast<int>(ParseNumber(key, value));
+        }
+        else if (key == "timer_slack")
+        {
+            properties.timerSlack = ParseNumber(key, value);
+        }
+        else if (key == "util_min")
+        {
+            properties.utilMin = static_cast<int>(ParseNumber(key, value));
+        }
+        else if (key == "util_max")
+        {
+            properties.utilMax = static_cast<int>(ParseNumber(key, value));
+        }
+        else if (key == "perf")
+        {
+            if (value != "on" && value != "off")
+            {
+                throw std::runtime_error("invalid perf value \"" + value + "\"");
+            }
+            properties.perfCounters = value == "on";
+        }
+        else if (key == "sampling")
+        {
+            properties.samplingPeriod = ParseNumber(key, value);
+        }
+        else
+        {
+            throw std::runtime_error("unknown key \"" + key + "\"");
+        }
+    }
+
+#ifndef _WIN32
+    // Without explicit cpus run on the CPUs of the NUMA node
+    if (!cpusDefined && properties.numaNode != thread::DEFAULT_NUMA_NODE)
+    {
+        properties.affinity = cpulist::read("/sys/devices/system/node/node" + std::to_string(properties.numaNode) + "/cpulist");
+    }
+#else
+    (void)cpusDefined;
+#endif
+
+    return properties;
+}
+
+
+inline int profile::ParsePolicy(const std::string& value)
+{
+    if (value == "default")
+    {
+        return thread::DEFAULT_POLICY;
+    }
+    if (value == "batch")
+    {
+        return thread::BATCH_POLICY;
+    }
+    if (value == "idle")
+    {
+        return thread::IDLE_POLICY;
+    }
+#ifdef _WIN32
+    if (value == "other" || value == "fifo" || value == "rr")
+    {
+        return thread::DEFAULT_POLICY; // windows doesn't support setting policy
+    }
+#else
+    if (value == "other")
+    {
+        return SCHED_OTHER;
+    }
+    if (value == "fifo")
+    {
+        return SCHED_FIFO;
+    }
+    if (value == "rr")
+    {
+        return SCHED_RR;
+    }
+#endif
+    throw std::runtime_error("unknown policy \"" + value + "\"");
+}
+
+
+inline int profile::ParseIoClass(const std::string& value)
+{
+    if (value == "rt")
+    {
+        return thread::IO_REALTIME_CLASS;
+    }
+    if (value == "be")
+    {
+        return thread::IO_BEST_EFFORT_CLASS;
+    }
+    if (value == "idle")
+    {
+        return thread::IO_IDLE_CLASS;
+    }
+    throw std::runtime_error("unknown I/O class \"" + value + "\"");
+}
+
+
+inline size_t profile::ParseSize(const std::string& value)
+{
+    size_t multiplier = 1;
+    std::string number = value;
+
+    switch (value.back())
+    {
+        case 'k': case 'K': multiplier = 1024; break;
+        case 'm': case 'M': multiplier = 1024 * 1024; break;
+        case 'g': case 'G': multiplier = 1024 * 1024 * 1024; break;
+        default: break;
+    }
+    if (multiplier != 1)
+    {
+        number.pop_back();
+    }
+
+    long size = ParseNumber("stack", number);
+    if (size < 0)
+    {
+        throw std::runtime_error("invalid stack size \"" + value + "\"");
+    }
+    return static_cast<size_t>(size) * multiplier;
+}
+
+
+inline long profile::ParseNumber(const std::string& key, const std::string& value)
+{
+    try
+    {
+        size_t parsed = 0;
+        long number = std::stol(value, &parsed);
+        if (parsed == value.size())
+        {
+            return number;
+        }
+    }
+    catch (std::exception&)
+    {
+    }
+    throw std::runtime_error("invalid " + key + " value \"" + value + "\"");
+}
+
+
+
+template <typename Function, typename... Args>
+thread::thread(const profile& threadProfile, Function&& func, Args&&... args)
+    : thread(PrebuiltAttributes{threadProfile.attributes()}, threadProfile.properties(),
+             std::forward<Function>(func), std::forward<Args>(args)...)
+{ }
+
+
+template <typename Function, typename... Args>
+thread::thread(const std::string& profileName, Function&& func, Args&&... args)
+    : thread(*profile::find(profileName), std::forward<Function>(func), std::forward<Args>(args)...)
+{ }
+
+
+} // namespace OSCompatible
+
+
+#endif //__profile__
@@ -0,0 +1,393 @@
+/**
+ * @file rcu.hpp
+ *
+ * @brief RCU-style snapshots of shared data (quiescent-state based): readers
+ * dereference the current snapshot with a plain acquire load, writers publish
+ * a new snapshot with a pointer swap, and the old one is freed once every
+ * attached thread reported a quiescent state (a point where it holds no
+ * snapshot pointer, e.g. between two messages).
+ *
+ * Readers never execute an atomic read-modify-write and are never blocked by
+ * writers, a reload costs the readers nothing but the cache miss on the new
+ * snapshot.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __rcu__
+#define __rcu__
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+
+
+namespace OSCompatible
+{
+
+class rcu_reader;
+
+
+/**
+ * @brief Process-wide grace period tracking of the reader threads.
+ *
+ * @code
+ * OSCompatible::rcu_pointer<Config> config(std::make_unique<Config>(load()));
+ *
+ * OSCompatible::thread worker(pinnedProps, [&]()
+ * {
+ *     OSCompatible::rcu_reader reader = OSCompatible::rcu::attach();
+ *     while (running)
+ *     {
+ *         const Config* current = config.read();   // valid until the next quiescent()
+ *         handle(nextMessage(), *current);
+ *         reader.quiescent();                      // a plain store, no RMW
+ *     }
+ * });
+ *
+ * config.update(std::make_unique<Config>(load())); // control thread, never waits for the worker
+ * @endcode
+ */
+class rcu
+{
+public:
+    /**
+     * @brief Registers the calling thread as a reader, it must report
+     * quiescent states (or go offline) for the retired snapshots to be freed.
+     */
+    static rcu_reader attach();
+
+    // Frees later, once every attached thread passed a quiescent state
+    static void retire(std::function<void()> deleter);
+
+    // Frees the retired snapshots no attached thread can still reference, @return number freed
+    static size_t reclaim();
+
+    // Waits until every attached thread passed a quiescent state, then reclaims
+    static void synchronize();
+
+    // Snapshots retired and not freed yet
+    static size_t pending();
+
+private:
+    friend class rcu_reader;
+
+    struct alignas(64) Record
+    {
+        std::atomic<uint64_t> seen{0};  // Last epoch the thread passed a quiescent state in, 0 while offline
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    struct State
+    {
+        alignas(64) std::atomic<uint64_t> epoch{1};
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Record>> readers;
+        std::vector<Retired> retired;
+    };
+
+    static State& GetState();
+
+    // Oldest epoch an online reader may still be in, UINT64_MAX without online readers
+    static uint64_t OldestSeen(State& state);
+};
+
+
+/**
+ * @brief Registration of a reader thread, detaches it when destroyed.
+ */
+class rcu_reader
+{
+public:
+    rcu_reader(rcu_reader&& other) noexcept = default;
+    rcu_reader& operator=(rcu_reader&& other) noexcept;
+    ~rcu_reader();
+
+    rcu_reader(const rcu_reader&) = delete;
+    rcu_reader& operator=(const rcu_reader&) = delete;
+
+    // The thread holds no snapshot pointer: a load and a release store to its own cache line
+    void quiescent()
+    {
+        m_record->seen.store(rcu::GetState().epoch.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    // Extended quiescent state before blocking (sleep, I/O), grace periods don't wait for the thread
+    void offline();
+
+    // Ends offline(), snapshots read afterwards are protected again
+    void online();
+
+    // Detaches the thread
+    void release();
+
+private:
+    friend class rcu;
+
+    explicit rcu_reader(std::shared_ptr<rcu::Record> record);
+
+    std::shared_ptr<rcu::Record> m_record;
+};
+
+
+/**
+ * @brief Versioned pointer to the current snapshot of a T.
+ *
+ * @note The snapshot is only protected in attached threads, between two of
+ * their quiescent states.
+ */
+template <typename T>
+class rcu_pointer
+{
+public:
+    explicit rcu_pointer(std::unique_ptr<T> initial = nullptr);
+
+    // Frees the current snapshot, no thread may still read it
+    ~rcu_pointer();
+
+    rcu_pointer(const rcu_pointer&) = delete;
+    rcu_pointer& operator=(const rcu_pointer&) = delete;
+
+    // Current snapshot, an acquire load
+    const T* read() const;
+
+    // Publishes a new snapshot and retires the previous one, @return the new version
+    uint64_t update(std::unique_ptr<T> value);
+
+    // Snapshots published so far
+    uint64_t version() const;
+
+private:
+    std::atomic<T*> m_pointer;
+    std::atomic<uint64_t> m_version;
+};
+
+
+
+inline rcu::State& rcu::GetState()
+{
+    static State state;
+    return state;
+}
+
+
+inline rcu_reader rcu::attach()
+{
+    State& state = GetState();
+    auto record = std::make_shared<Record>();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.readers.push_back(record);
+    }
+
+    rcu_reader reader(std::move(record));
+    reader.online();
+    return reader;
+}
+
+
+inline uint64_t rcu::OldestSeen(State& state)
+{
+    uint64_t oldest = UINT64_MAX;
+    for (const auto& record : state.readers)
+    {
+        const uint64_t seen = record->seen.load(std::memory_order_seq_cst);
+        if (seen != 0 && seen < oldest)
+        {
+            oldest = seen;
+        }
+    }
+    return oldest;
+}
+
+
+inline void rcu::retire(std::function<void()> deleter)
+{
+    State& state = GetState();
+
+    // Readers that pass a quiescent state from now on report the new epoch, they can't hold the retired data
+    const uint64_t epoch = state.epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.retired.push_back({epoch, std::move(deleter)});
+    }
+    reclaim();
+}
+
+
+inline size_t rcu::reclaim()
+{
+    State& state = GetState();
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        // Finished readers are referenced only from here
+        state.readers.erase(std::remove_if(state.readers.begin(), state.readers.end(),
+                                           [](const std::shared_ptr<Record>& record) { return record.use_count() == 1; }),
+                            state.readers.end());
+
+        const uint64_t oldest = OldestSeen(state);
+        auto kept = std::partition(state.retired.begin(), state.retired.end(),
+                                   [oldest](const Retired& retired) { return retired.epoch > oldest; });
+        std::move(kept, state.retired.end(), std::back_inserter(ready));
+        state.retired.erase(kept, state.retired.end());
+    }
+
+    // Deleters run outside of the lock, they may retire too
+    for (Retired& retired : ready)
+    {
+        retired.deleter();
+    }
+    return ready.size();
+}
+
+
+inline void rcu::synchronize()
+{
+    State& state = GetState();
+    const uint64_t epoch = state.epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+    uint32_t spin = 0;
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (OldestSeen(state) >= epoch)
+            {
+                break;
+            }
+        }
+
+        if (++spin < 100)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    reclaim();
+}
+
+
+inline size_t rcu::pending()
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.retired.size();
+}
+
+
+
+inline rcu_reader::rcu_reader(std::shared_ptr<rcu::Record> record)
+    :
+    m_record(std::move(record))
+{ }
+
+
+inline rcu_reader& rcu_reader::operator=(rcu_reader&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_record = std::move(other.m_record);
+    }
+    return *this;
+}
+
+
+inline rcu_reader::~rcu_reader()
+{
+    release();
+}
+
+
+inline void rcu_reader::offline()
+{
+    m_record->seen.store(0, std::memory_order_release);
+}
+
+
+inline void rcu_reader::online()
+{
+    m_record->seen.store(rcu::GetState().epoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+    // Pointers read after this are newer than any retire that missed the thread while it was offline
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+
+inline void rcu_reader::release()
+{
+    if (m_record)
+    {
+        offline();
+        m_record.reset();
+    }
+}
+
+
+
+template <typename T>
+rcu_pointer<T>::rcu_pointer(std::unique_ptr<T> initial)
+    :
+    m_pointer(initial.release()),
+    m_version(0)
+{ }
+
+
+template <typename T>
+rcu_pointer<T>::~rcu_pointer()
+{
+    delete m_pointer.load(std::memory_order_acquire);
+}
+
+
+template <typename T>
+const T* rcu_pointer<T>::read() const
+{
+    return m_pointer.load(std::memory_order_acquire);
+}
+
+
+template <typename T>
+uint64_t rcu_pointer<T>::update(std::unique_ptr<T> value)
+{
+    T* previous = m_pointer.exchange(value.release(), std::memory_order_seq_cst);
+    const uint64_t version = m_version.fetch_add(1, std::memory_order_release) + 1;
+
+    if (previous != nullptr)
+    {
+        rcu::retire([previous]() { delete previous; });
+    }
+    return version;
+}
+
+
+template <typename T>
+uint64_t rcu_pointer<T>::version() const
+{
+    return m_version.load(std::memory_order_acquire);
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__rcu__
@@ -0,0 +1,455 @@
+/**
+ * @file registry.hpp
+ *
+ * @brief Process-wide registry of the live OSCompatible threads, so operators
+ * and benchmarks can inspect the threads and their placement without attaching
+ * a debugger.
+ *
+ * Every OSCompatible::thread registers itself when it starts (name, kernel
+ * tid, configured properties, start time and state) and unregisters when its
+ * function returns. Registration and snapshots are lock-free: threads claim a
+ * slot of a fixed table with a CAS, and each slot is a seqlock written only by
+ * its owning thread.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+// thread.hpp includes this header at its end, right after the thread class
+// and before the headers using the registry (stats.hpp...): start from it, so
+// the registry is declared before them whichever header a TU includes first
+#include "OSCompatible/thread.hpp"
+
+#ifndef __registry__
+#define __registry__
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <thread>
+
+#include "OSCompatible/idle_strategy.hpp"
+
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+class registry
+{
+public:
+    static constexpr size_t CAPACITY = 1024;            // Threads tracked at the same time, others are not registered
+    static constexpr size_t NO_SLOT = static_cast<size_t>(-1);
+
+    enum class State
+    {
+        starting,   // applying the properties
+        running     // running the thread function
+    };
+
+    struct Entry
+    {
+        std::string name;
+        long tid;                                       // Kernel thread id (Windows thread id)
+        thread::Properties properties;                  // Configured properties
+        std::chrono::system_clock::time_point startTime;
+        State state;
+    };
+
+    /**
+     * @brief Copies the entries of all the live registered threads.
+     *
+     * Doesn't block the registering threads, an entry changing during the
+     * copy is read again, a bounded number of times: an entry whose owner
+     * stays in the middle of an update (preempted) is left out.
+     */
+    static std::vector<Entry> snapshot();
+
+    // Number of live registered threads
+    static size_t size();
+
+    /**
+     * @brief Effective properties of a thread as the kernel reports them
+     * (policy, priority, nice and affinity), to compare with the configured
+     * ones. Linux only, on Windows the default properties are returned.
+     */
+    static thread::Properties effective(long tid);
+
+    // Kernel tid of the calling thread
+    static long currentTid();
+
+    // Slot of the calling OSCompatible thread, NO_SLOT if it isn't registered
+    static size_t currentSlot();
+
+private:
+    friend class thread;
+
+    static constexpr size_t NAME_SIZE = 32;
+    static constexpr size_t AFFINITY_WORDS = 1024 / 64;  // CPU_SETSIZE CPUs
+
+    // Trivially copyable copy of the entry, stored in the relaxed atomic words
+    // of its slot so it can be read under the seqlock
+    struct Record
+    {
+        char name[NAME_SIZE];
+        long tid;
+        int priority;
+        int policy;
+        int nice;
+        int ioPriorityClass;
+        int ioPriorityLevel;
+        long timerSlack;
+        int utilMin;
+        int utilMax;
+        size_t stackSize;
+        int numaNode;
+        size_t affinitySize;
+        uint64_t affinity[AFFINITY_WORDS];
+        int64_t startTimeNs;
+        int state;
+    };
+
+    static constexpr size_t RECORD_WORDS = (sizeof(Record) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // Copies of a slot tried before a snapshot skips it (owner preempted in the middle of a write)
+    static constexpr uint32_t READ_ATTEMPTS = 256;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<bool> used;
+        std::atomic<uint32_t> sequence; // odd while the owner writes the record
+        std::atomic<uint64_t> record[RECORD_WORDS];
+    };
+
+    static Slot* Slots();
+    static size_t& CurrentSlot();
+
+    static size_t Insert(const thread::Properties& properties);
+    static void SetState(size_t slot, State state);
+    static void Remove(size_t slot);
+    static void BeginWrite(Slot& slot);
+    static void EndWrite(Slot& slot);
+    static void Store(Slot& slot, const Record& record);
+    static Record Load(const Slot& slot);
+};
+
+
+
+inline registry::Slot* registry::Slots()
+{
+    static Slot slots[CAPACITY] = {};
+    return slots;
+}
+
+
+inline size_t& registry::CurrentSlot()
+{
+    thread_local size_t slot = NO_SLOT;
+    return slot;
+}
+
+
+inline long registry::currentTid()
+{
+    return thread::CurrentTid();
+}
+
+
+inline size_t registry::currentSlot()
+{
+    return CurrentSlot();
+}
+
+
+inline void registry::BeginWrite(Slot& slot)
+{
+    slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+
+inline void registry::EndWrite(Slot& slot)
+{
+    slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+inline void registry::Store(Slot& slot, const Record& record)
+{
+    uint64_t words[RECORD_WORDS] = {0};
+    std::memcpy(words, &record, sizeof(Record));
+    for (size_t i = 0; i < RECORD_WORDS; ++i)
+    {
+        slot.record[i].store(words[i], std::memory_order_relaxed);
+    }
+}
+
+
+inline registry::Record registry::Load(const Slot& slot)
+{
+    uint64_t words[RECORD_WORDS];
+    for (size_t i = 0; i < RECORD_WORDS; ++i)
+    {
+        words[i] = slot.record[i].load(std::memory_order_relaxed);
+    }
+
+    Record record;
+    std::memcpy(&record, words, sizeof(Record));
+    return record;
+}
+
+
+inline size_t registry::Insert(const thread::Properties& properties)
+{
+    Slot* slots = Slots();
+
+    for (size_t i = 0; i < CAPACITY; ++i)
+    {
+        bool expected = false;
+        if (slots[i].used.load(std::memory_order_relaxed) ||
+            !slots[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        Slot& slot = slots[i];
+
+        Record record;
+        std::memset(&record, 0, sizeof(Record));
+        std::strncpy(record.name, properties.name.c_str(), NAME_SIZE - 1);
+        record.tid = currentTid();
+        record.priority = properties.priority;
+        record.policy = properties.policy;
+        record.nice = properties.nice;
+        record.ioPriorityClass = properties.ioPriorityClass;
+        record.ioPriorityLevel = properties.ioPriorityLevel;
+        record.timerSlack = properties.timerSlack;
+        record.utilMin = properties.utilMin;
+        record.utilMax = properties.utilMax;
+        record.stackSize = properties.stackSize;
+        record.numaNode = properties.numaNode;
+        record.affinitySize = std::min(properties.affinity.size(), AFFINITY_WORDS * 64);
+        for (size_t cpu = 0; cpu < record.affinitySize; ++cpu)
+        {
+            if (properties.affinity[cpu])
+            {
+                record.affinity[cpu / 64] |= uint64_t(1) << (cpu % 64);
+            }
+        }
+        record.startTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        record.state = static_cast<int>(State::starting);
+
+        BeginWrite(slot);
+        Store(slot, record);
+        EndWrite(slot);
+
+        CurrentSlot() = i;
+        return i;
+    }
+
+    return NO_SLOT; // registry is full, the thread runs untracked
+}
+
+
+inline void registry::SetState(size_t slot, State state)
+{
+    if (slot == NO_SLOT)
+    {
+        return;
+    }
+
+    // Only the owner writes its slot, its own copy is never torn
+    Slot& s = Slots()[slot];
+    Record record = Load(s);
+    record.state = static_cast<int>(state);
+
+    BeginWrite(s);
+    Store(s, record);
+    EndWrite(s);
+}
+
+
+inline void registry::Remove(size_t slot)
+{
+    if (slot == NO_SLOT)
+    {
+        return;
+    }
+
+    CurrentSlot() = NO_SLOT;
+    Slots()[slot].used.store(false, std::memory_order_release);
+}
+
+
+inline std::vector<registry::Entry> registry::snapshot()
+{
+    std::vector<Entry> entries;
+    Slot* slots = Slots();
+
+    for (size_t i = 0; i < CAPACITY; ++i)
+    {
+        Slot& slot = slots[i];
+        Record record;
+        bool consistent = false;
+
+        for (uint32_t attempt = 0; attempt < READ_ATTEMPTS && slot.used.load(std::memory_order_acquire); ++attempt)
+        {
+            const uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if ((before & 1) == 0)
+            {
+                record = Load(slot);
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.sequence.load(std::memory_order_relaxed) == before)
+                {
+                    consistent = slot.used.load(std::memory_order_relaxed);
+                    break;
+                }
+            }
+
+            // The owner is writing: a few pauses, then let it run if it shares the CPU
+            if (attempt < READ_ATTEMPTS / 2)
+            {
+                idle::pause();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        if (!consistent)
+        {
+            continue;
+        }
+
+        Entry entry;
+        entry.name = record.name;
+        entry.tid = record.tid;
+        entry.properties = thread::DEFAULT_PROPERTIES;
+        entry.properties.name = record.name;
+        entry.properties.priority = record.priority;
+        entry.properties.policy = record.policy;
+        entry.properties.nice = record.nice;
+        entry.properties.ioPriorityClass = record.ioPriorityClass;
+        entry.properties.ioPriorityLevel = record.ioPriorityLevel;
+        entry.properties.timerSlack = record.timerSlack;
+        entry.properties.utilMin = record.utilMin;
+        entry.properties.utilMax = record.utilMax;
+        entry.properties.stackSize = record.stackSize;
+        entry.properties.numaNode = record.numaNode;
+        entry.properties.affinity.assign(record.affinitySize, false);
+        for (size_t cpu = 0; cpu < record.affinitySize; ++cpu)
+        {
+            entry.properties.affinity[cpu] = (record.affinity[cpu / 64] >> (cpu % 64)) & 1;
+        }
+        entry.startTime = std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(record.startTimeNs)));
+        entry.state = static_cast<State>(record.state);
+
+        entries.push_back(std::move(entry));
+    }
+
+    return entries;
+}
+
+
+inline size_t registry::size()
+{
+    size_t count = 0;
+    Slot* slots = Slots();
+
+    for (size_t i = 0; i < CAPACITY; ++i)
+    {
+        count += slots[i].used.load(std::memory_order_relaxed) ? 1 : 0;
+    }
+    return count;
+}
+
+
+inline thread::Properties registry::effective(long tid)
+{
+    thread::Properties properties = thread::DEFAULT_PROPERTIES;
+
+#ifndef _WIN32
+    pid_t pid = static_cast<pid_t>(tid);
+
+    int policy = sched_getscheduler(pid);
+    if (policy >= 0)
+    {
+        properties.policy = policy & ~SCHED_RESET_ON_FORK;
+    }
+
+    struct sched_param param;
+    if (sched_getparam(pid, &param) == 0)
+    {
+        properties.priority = param.sched_priority;
+    }
+
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, static_cast<id_t>(pid));
+    if (errno == 0)
+    {
+        properties.nice = nice;
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(pid, sizeof(cpuset), &cpuset) == 0)
+    {
+        properties.affinity.assign(CPU_SETSIZE, false);
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            properties.affinity[cpu] = CPU_ISSET(cpu, &cpuset);
+        }
+        while (!properties.affinity.empty() && !properties.affinity.back())
+        {
+            properties.affinity.pop_back();
+        }
+    }
+#else
+    (void)tid;
+#endif
+
+    return properties;
+}
+
+
+
+// Registry hooks of the thread class
+
+inline size_t thread::RegisterThread(const Properties& properties)
+{
+    return registry::Insert(properties);
+}
+
+
+inline void thread::SetThreadRunning(size_t slot)
+{
+    registry::SetState(slot, registry::State::running);
+}
+
+
+inline void thread::UnregisterThread(size_t slot)
+{
+    registry::Remove(slot);
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__registry__
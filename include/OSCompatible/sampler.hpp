@@ -0,0 +1,621 @@
+/**
+ * @file sampler.hpp
+ *
+ * @brief Low-rate per-thread sampling profiler producing flamegraph-ready
+ * folded stacks, for always-on profiling of pinned workers without running
+ * perf as root.
+ *
+ * Each sampled thread owns a POSIX timer on its own CPU clock
+ * (CLOCK_THREAD_CPUTIME_ID) delivering SIGPROF to that thread only
+ * (SIGEV_THREAD_ID), so idle threads are not sampled and a busy thread is
+ * sampled at the configured rate of its CPU time. The signal handler unwinds
+ * the stack into a per-thread lock-free ring, the export drains the rings,
+ * symbolizes the frames (dladdr, demangled) and folds them per thread name.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __sampler__
+#define __sampler__
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <thread>
+
+#include "OSCompatible/thread.hpp"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Sampling profiler of the threads of the process.
+ *
+ * A thread is sampled from spawn by setting Properties::samplingPeriod (or
+ * the "sampling" key of its profile), or by calling sampler::start() from
+ * the thread itself. Stacks are tagged with the thread name, which is the
+ * profile name for the threads created from a profile.
+ *
+ * @code
+ * OSCompatible::thread worker("matcher", matchLoop); // matcher: ... sampling=10000
+ * ...
+ * OSCompatible::sampler::write("matcher.folded");   // flamegraph.pl matcher.folded > matcher.svg
+ * @endcode
+ *
+ * @note Linux only, on Windows nothing is sampled.
+ * @note CPU clock timers expire on scheduler ticks, periods below the tick
+ * (1-4ms depending on CONFIG_HZ) are rounded up to it.
+ * @note Link the executable with -rdynamic so its own functions get names,
+ * frames without a dynamic symbol are reported as module+offset.
+ * @warning The profiler owns SIGPROF, don't use it together with setitimer
+ * based profilers (gprof, gperftools).
+ */
+class sampler
+{
+public:
+    static constexpr size_t MAX_DEPTH = 64;     // Frames kept of each sample
+    static constexpr size_t RING_SIZE = 1024;   // Samples buffered per thread between two exports
+
+    /**
+     * @brief Starts sampling the calling thread.
+     *
+     * @param period Thread CPU time between two samples.
+     * @param name Tag of the stacks, empty for the thread name.
+     */
+    static void start(std::chrono::microseconds period, const std::string& name = "");
+
+    // Stops sampling the calling thread, its samples are kept until exported
+    static void stop();
+
+    // The calling thread is being sampled
+    static bool active();
+
+    /**
+     * @brief Folded stacks of all the samples so far, one "name;outer;...;leaf
+     * count" line per distinct stack, the input format of flamegraph.pl and
+     * speedscope.
+     */
+    static std::string folded();
+
+    // Writes folded() to a file
+    static void write(const std::string& path);
+
+    // Samples lost because a ring was full between two exports
+    static uint64_t dropped();
+
+    // Forgets the folded samples so far
+    static void reset();
+
+    /**
+     * @brief Captures the current stack of a thread of this process, sampled
+     * or not, by signaling it (tgkill).
+     *
+     * @param tid Kernel thread id.
+     * @param timeout Time to wait for the thread to run the signal handler.
+     * @return The folded stack "outer;...;leaf", empty if the thread didn't
+     * answer in time (blocked in uninterruptible sleep, finished...).
+     */
+    static std::string stack(long tid, std::chrono::milliseconds timeout = std::chrono::milliseconds(100));
+
+private:
+    friend class thread;
+
+    // Frames of the signal handler and the signal trampoline on top of each sample
+    static constexpr size_t SKIP_FRAMES = 2;
+
+    struct Sample
+    {
+        uint32_t depth;
+        void* frames[MAX_DEPTH];
+    };
+
+    // Single producer (the signal handler of the owning thread), single
+    // consumer (the export, under the state mutex)
+    struct Buffer
+    {
+        std::string name;
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> finished{false};
+        Sample samples[RING_SIZE];
+    };
+
+    // Stack requested by stack(), one at a time: the handler claims the open
+    // request before writing the sample, so a late handler never writes into
+    // a later request
+    struct Capture
+    {
+        std::mutex mutex;                   // Serializes the requests
+        uint64_t generation = 0;            // Last request, under the mutex
+        std::atomic<long> tid{0};
+        std::atomic<uint64_t> open{0};      // Request not claimed by a handler yet, 0 if none
+        std::atomic<uint64_t> done{0};      // Last request whose sample is written
+        Sample sample;
+    };
+
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Buffer>> buffers;
+        std::map<std::string, uint64_t> stacks;
+        std::map<void*, std::string> symbols;
+        uint64_t dropped = 0;
+    };
+
+#ifndef _WIN32
+    // Per-thread sampling, the buffer pointer is the only state the handler reads
+    struct ThreadState
+    {
+        std::shared_ptr<Buffer> buffer;
+        timer_t timer;
+        bool active = false;
+    };
+
+    static ThreadState& CurrentState();
+    static Buffer*& CurrentBuffer();
+    static void InstallHandler();
+    static void OnSignal(int signal, siginfo_t* info, void* context);
+    static std::string Symbolize(State& state, void* address);
+    static std::string Fold(State& state, const Sample& sample);
+#endif
+
+    static State& GetState();
+    static Capture& GetCapture();
+    static void Drain(State& state);
+};
+
+
+
+inline sampler::State& sampler::GetState()
+{
+    static State state;
+    return state;
+}
+
+
+inline sampler::Capture& sampler::GetCapture()
+{
+    static Capture capture;
+    return capture;
+}
+
+
+#ifndef _WIN32
+
+inline sampler::ThreadState& sampler::CurrentState()
+{
+    thread_local ThreadState state;
+    return state;
+}
+
+
+inline sampler::Buffer*& sampler::CurrentBuffer()
+{
+    // Trivial thread_local, safe to access from the signal handler
+    static thread_local Buffer* buffer = nullptr;
+    return buffer;
+}
+
+
+inline void sampler::OnSignal(int signal, siginfo_t* info, void* context)
+{
+    (void)signal;
+    (void)context;
+
+    const int savedErrno = errno;
+
+    // Signal sent by stack() rather than by the sampling timer
+    if (info != nullptr && info->si_code == SI_TKILL)
+    {
+        Capture& capture = GetCapture();
+        uint64_t request = capture.open.load(std::memory_order_acquire);
+        if (request != 0 &&
+            capture.tid.load(std::memory_order_relaxed) == thread::CurrentTid() &&
+            capture.open.compare_exchange_strong(request, 0, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            int depth = backtrace(capture.sample.frames, static_cast<int>(MAX_DEPTH));
+            capture.sample.depth = depth > 0 ? static_cast<uint32_t>(depth) : 0;
+            capture.done.store(request, std::memory_order_release);
+        }
+        errno = savedErrno;
+        return;
+    }
+
+    Buffer* buffer = CurrentBuffer();
+    if (buffer != nullptr)
+    {
+        const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+        if (head - buffer->tail.load(std::memory_order_acquire) >= RING_SIZE)
+        {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            Sample& sample = buffer->samples[head % RING_SIZE];
+            int depth = backtrace(sample.frames, static_cast<int>(MAX_DEPTH));
+            sample.depth = depth > 0 ? static_cast<uint32_t>(depth) : 0;
+            buffer->head.store(head + 1, std::memory_order_release);
+        }
+    }
+
+    errno = savedErrno;
+}
+
+
+inline void sampler::InstallHandler()
+{
+    static std::once_flag installed;
+    static int result = 0;
+
+    std::call_once(installed, []()
+    {
+        // The first backtrace call loads the unwinder (libgcc_s) with malloc
+        // and dlopen, do it here so the calls from the handler are signal safe
+        void* frames[1];
+        backtrace(frames, 1);
+
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = &sampler::OnSignal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+
+        result = sigaction(SIGPROF, &action, nullptr) == 0 ? 0 : errno;
+    });
+
+    if (result != 0)
+    {
+        throw std::runtime_error("Failed to install the sampling signal handler: " + std::string(strerror(result)));
+    }
+}
+
+#endif
+
+
+inline void sampler::start(std::chrono::microseconds period, const std::string& name)
+{
+#ifndef _WIN32
+    if (period.count() <= 0)
+    {
+        throw std::runtime_error("Failed to start sampling: period must be positive");
+    }
+
+    ThreadState& state = CurrentState();
+    if (state.active)
+    {
+        stop();
+    }
+
+    InstallHandler();
+
+    auto buffer = std::make_shared<Buffer>();
+    buffer->name = name;
+    if (buffer->name.empty())
+    {
+        char threadName[16] = {0};
+        pthread_getname_np(pthread_self(), threadName, sizeof(threadName));
+        buffer->name = threadName;
+    }
+
+    struct sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = static_cast<pid_t>(thread::CurrentTid());
+
+    timer_t timer;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0)
+    {
+        throw std::runtime_error("Failed to create sampling timer: " + std::string(strerror(errno)));
+    }
+
+    {
+        State& shared = GetState();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        shared.buffers.push_back(buffer);
+    }
+
+    state.buffer = buffer;
+    state.timer = timer;
+    state.active = true;
+    CurrentBuffer() = buffer.get();
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = static_cast<time_t>(period.count() / 1000000);
+    spec.it_interval.tv_nsec = static_cast<long>(period.count() % 1000000) * 1000;
+    spec.it_value = spec.it_interval;
+
+    if (timer_settime(timer, 0, &spec, nullptr) != 0)
+    {
+        int err = errno;
+        stop();
+        throw std::runtime_error("Failed to start sampling timer: " + std::string(strerror(err)));
+    }
+#else
+    (void)period;
+    (void)name;
+#endif
+}
+
+
+inline void sampler::stop()
+{
+#ifndef _WIN32
+    ThreadState& state = CurrentState();
+    if (!state.active)
+    {
+        return;
+    }
+
+    // No signal is generated after the timer is deleted, a pending one still
+    // finds the buffer alive through the shared state
+    timer_delete(state.timer);
+    CurrentBuffer() = nullptr;
+
+    state.buffer->finished.store(true, std::memory_order_release);
+    state.buffer.reset();
+    state.active = false;
+#endif
+}
+
+
+inline bool sampler::active()
+{
+#ifndef _WIN32
+    return CurrentState().active;
+#else
+    return false;
+#endif
+}
+
+
+#ifndef _WIN32
+
+inline std::string sampler::Symbolize(State& state, void* address)
+{
+    auto it = state.symbols.find(address);
+    if (it != state.symbols.end())
+    {
+        return it->second;
+    }
+
+    std::string symbol;
+    Dl_info info{};
+    const bool found = dladdr(address, &info) != 0;
+    if (found && info.dli_sname != nullptr)
+    {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        symbol = status == 0 && demangled != nullptr ? demangled : info.dli_sname;
+        std::free(demangled);
+    }
+    else if (found && info.dli_fname != nullptr && info.dli_fname[0] != '\0')
+    {
+        const char* module = std::strrchr(info.dli_fname, '/');
+        char offset[32];
+        std::snprintf(offset, sizeof(offset), "+0x%lx",
+                      static_cast<unsigned long>(static_cast<char*>(address) - static_cast<char*>(info.dli_fbase)));
+        symbol = std::string(module != nullptr ? module + 1 : info.dli_fname) + offset;
+    }
+    else
+    {
+        char hex[32];
+        std::snprintf(hex, sizeof(hex), "0x%lx", reinterpret_cast<unsigned long>(address));
+        symbol = hex;
+    }
+
+    // ';' separates the frames of a folded stack
+    for (char& c : symbol)
+    {
+        if (c == ';')
+        {
+            c = ':';
+        }
+    }
+
+    state.symbols.emplace(address, symbol);
+    return symbol;
+}
+
+
+inline std::string sampler::Fold(State& state, const Sample& sample)
+{
+    std::string stack;
+    for (size_t frame = sample.depth; frame > SKIP_FRAMES; --frame)
+    {
+        // Return addresses point after the call, except the interrupted one
+        char* address = static_cast<char*>(sample.frames[frame - 1]);
+        if (!stack.empty())
+        {
+            stack += ';';
+        }
+        stack += Symbolize(state, frame - 1 == SKIP_FRAMES ? address : address - 1);
+    }
+    return stack;
+}
+
+#endif
+
+
+inline void sampler::Drain(State& state)
+{
+#ifndef _WIN32
+    for (auto it = state.buffers.begin(); it != state.buffers.end(); )
+    {
+        Buffer& buffer = **it;
+
+        // Read finished before head, so nothing is left behind a finished buffer
+        const bool finished = buffer.finished.load(std::memory_order_acquire);
+        const uint64_t head = buffer.head.load(std::memory_order_acquire);
+        uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+
+        for (; tail != head; ++tail)
+        {
+            const Sample& sample = buffer.samples[tail % RING_SIZE];
+
+            std::string stack = buffer.name.empty() ? "[unnamed]" : buffer.name;
+            std::string frames = Fold(state, sample);
+            if (!frames.empty())
+            {
+                stack += ';' + frames;
+            }
+            ++state.stacks[stack];
+        }
+        buffer.tail.store(tail, std::memory_order_release);
+
+        state.dropped += buffer.dropped.exchange(0, std::memory_order_relaxed);
+
+        if (finished)
+        {
+            it = state.buffers.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+#else
+    (void)state;
+#endif
+}
+
+
+inline std::string sampler::folded()
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    Drain(state);
+
+    std::string result;
+    for (const auto& stack : state.stacks)
+    {
+        result += stack.first + " " + std::to_string(stack.second) + "\n";
+    }
+    return result;
+}
+
+
+inline void sampler::write(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open folded stacks file " + path + ": " + std::string(strerror(errno)));
+    }
+    file << folded();
+}
+
+
+inline uint64_t sampler::dropped()
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    Drain(state);
+    return state.dropped;
+}
+
+
+inline void sampler::reset()
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    Drain(state);
+    state.stacks.clear();
+    state.dropped = 0;
+}
+
+
+inline std::string sampler::stack(long tid, std::chrono::milliseconds timeout)
+{
+#ifndef _WIN32
+    InstallHandler();
+
+    Capture& capture = GetCapture();
+    std::lock_guard<std::mutex> lock(capture.mutex);
+
+    const uint64_t request = ++capture.generation;
+    capture.tid.store(tid, std::memory_order_relaxed);
+    capture.open.store(request, std::memory_order_release);
+
+    // A failed signal withdraws the request right away
+    const bool signaled = syscall(SYS_tgkill, static_cast<pid_t>(getpid()), static_cast<pid_t>(tid), SIGPROF) == 0;
+    const auto deadline = std::chrono::steady_clock::now() + (signaled ? timeout : std::chrono::milliseconds(0));
+    while (capture.done.load(std::memory_order_acquire) != request)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            // Withdraw the request, unless a handler claimed it already: it is
+            // writing the sample then, wait for it before the next request
+            uint64_t open = request;
+            if (capture.open.compare_exchange_strong(open, 0, std::memory_order_relaxed))
+            {
+                return "";
+            }
+            while (capture.done.load(std::memory_order_acquire) != request)
+            {
+                std::this_thread::yield();
+            }
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    State& state = GetState();
+    std::lock_guard<std::mutex> stateLock(state.mutex);
+    return Fold(state, capture.sample);
+#else
+    (void)tid;
+    (void)timeout;
+    return "";
+#endif
+}
+
+
+
+// Sampling hooks of the thread class
+
+inline void thread::StartSampling(const Properties& properties)
+{
+    sampler::start(std::chrono::microseconds(properties.samplingPeriod), properties.name);
+}
+
+
+inline void thread::StopSampling()
+{
+    sampler::stop();
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__sampler__
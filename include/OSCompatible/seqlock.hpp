@@ -0,0 +1,155 @@
+/**
+ * @file seqlock.hpp
+ *
+ * @brief Sequence lock for small trivially copyable values (configuration,
+ * parameters) read on every message by pinned workers: readers never write
+ * shared memory, they copy the value and retry if a writer changed it
+ * meanwhile, writers never wait for readers.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __seqlock__
+#define __seqlock__
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+#include "OSCompatible/idle_strategy.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Value of type T shared between writers and lock-free readers.
+ *
+ * The value is kept in relaxed atomic words, so a read racing with a write
+ * is well defined (and retried), keep T small: a read copies all of it.
+ *
+ * @code
+ * struct Limits { double maxPrice; int64_t maxQuantity; };
+ * OSCompatible::seqlock<Limits> limits(Limits{100.0, 10});
+ *
+ * Limits current = limits.load();         // worker, per message
+ * limits.store(Limits{120.0, 10});        // control thread, on reload
+ * @endcode
+ */
+template <typename T>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock values are copied bytewise");
+    static_assert(std::is_default_constructible<T>::value, "seqlock values are copied into a default constructed T");
+
+public:
+    explicit seqlock(const T& value = T());
+
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    // Consistent copy of the value, retries while a store is in progress
+    T load() const;
+
+    // Publishes a new value, concurrent stores are serialized
+    void store(const T& value);
+
+    // Stores done so far
+    uint64_t version() const;
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    alignas(64) std::atomic<uint64_t> m_sequence;   // Odd while a store is in progress
+    std::atomic<uint64_t> m_words[WORDS];
+    std::mutex m_writer;
+};
+
+
+
+template <typename T>
+seqlock<T>::seqlock(const T& value)
+    :
+    m_sequence(0),
+    m_writer()
+{
+    uint64_t words[WORDS] = {0};
+    std::memcpy(words, &value, sizeof(T));
+    for (size_t i = 0; i < WORDS; ++i)
+    {
+        m_words[i].store(words[i], std::memory_order_relaxed);
+    }
+}
+
+
+template <typename T>
+T seqlock<T>::load() const
+{
+    uint64_t words[WORDS];
+
+    for (;;)
+    {
+        const uint64_t before = m_sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            idle::pause();
+            continue;
+        }
+
+        for (size_t i = 0; i < WORDS; ++i)
+        {
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        }
+
+        // The copy is complete before the sequence is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_sequence.load(std::memory_order_relaxed) == before)
+        {
+            break;
+        }
+    }
+
+    T value;
+    std::memcpy(&value, words, sizeof(T));
+    return value;
+}
+
+
+template <typename T>
+void seqlock<T>::store(const T& value)
+{
+    uint64_t words[WORDS] = {0};
+    std::memcpy(words, &value, sizeof(T));
+
+    std::lock_guard<std::mutex> lock(m_writer);
+
+    const uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    // The odd sequence is visible before any word changes
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < WORDS; ++i)
+    {
+        m_words[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+template <typename T>
+uint64_t seqlock<T>::version() const
+{
+    return m_sequence.load(std::memory_order_acquire) / 2;
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__seqlock__
@@ -0,0 +1,152 @@
+/**
+ * @file spin_mutex.hpp
+ *
+ * @brief Hybrid spin-then-park mutex for short critical sections of pinned
+ * threads: a FIFO ticket lock whose waiters spin for a bounded number of
+ * pause instructions before parking on a futex, with targeted wakeups of the
+ * next ticket instead of waking every parked waiter.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __spin_mutex__
+#define __spin_mutex__
+#include <atomic>
+#include <cstdint>
+
+#include "OSCompatible/futex.hpp"
+#include "OSCompatible/idle_strategy.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Fair (FIFO) mutex spinning before it sleeps, a Lockable usable with
+ * std::lock_guard, std::unique_lock and futex_condition.
+ *
+ * std::mutex parks a waiter after a few spins, which costs a sleep and a
+ * wakeup for locks held for tens of nanoseconds. spin_mutex keeps spinning
+ * while the holder is likely to release soon and parks only after the spin
+ * budget, so it still behaves when the holder is preempted.
+ *
+ * @note Tickets are served in order: a parked waiter next in line delays the
+ * waiters after it by its wakeup, size the spin budget over the usual hold time.
+ *
+ * @code
+ * OSCompatible::spin_mutex mutex;
+ * {
+ *     std::lock_guard<OSCompatible::spin_mutex> lock(mutex);
+ *     book.apply(order);
+ * }
+ * @endcode
+ */
+class spin_mutex
+{
+public:
+    static constexpr uint32_t DEFAULT_SPINS = 1000;     // Pause instructions, a few to tens of microseconds depending on the CPU
+    static constexpr uint32_t SLOTS = 8;                // Parking words, waiters of tickets SLOTS apart share one
+
+    explicit spin_mutex(uint32_t spins = DEFAULT_SPINS);
+
+    spin_mutex(const spin_mutex&) = delete;
+    spin_mutex& operator=(const spin_mutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+private:
+    void Park(uint32_t ticket);
+
+    std::atomic<uint32_t> m_next;           // Next ticket to hand out
+    std::atomic<uint32_t> m_serving;        // Ticket holding the lock
+    std::atomic<uint32_t> m_parked;         // Waiters asleep (or about to be), unlock skips the syscall at 0
+    std::atomic<uint32_t> m_slots[SLOTS];   // Wakeup counters the waiters park on, by ticket
+    uint32_t m_spins;
+};
+
+
+
+inline spin_mutex::spin_mutex(uint32_t spins)
+    :
+    m_next(0),
+    m_serving(0),
+    m_parked(0),
+    m_spins(spins)
+{
+    for (uint32_t slot = 0; slot < SLOTS; ++slot)
+    {
+        m_slots[slot].store(0, std::memory_order_relaxed);
+    }
+}
+
+
+inline void spin_mutex::lock()
+{
+    const uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+
+    for (uint32_t spin = 0; spin < m_spins; ++spin)
+    {
+        if (m_serving.load(std::memory_order_acquire) == ticket)
+        {
+            return;
+        }
+        idle::pause();
+    }
+
+    Park(ticket);
+}
+
+
+inline bool spin_mutex::try_lock()
+{
+    // The acquire load of m_serving synchronizes with the unlock of the previous holder, the CAS on m_next doesn't
+    uint32_t serving = m_serving.load(std::memory_order_acquire);
+    return m_next.compare_exchange_strong(serving, serving + 1, std::memory_order_relaxed, std::memory_order_relaxed);
+}
+
+
+inline void spin_mutex::unlock()
+{
+    const uint32_t next = m_serving.load(std::memory_order_relaxed) + 1;
+    m_serving.store(next, std::memory_order_seq_cst);
+
+    // A parking waiter counts itself before re-checking m_serving, one of the two sides sees the other
+    if (m_parked.load(std::memory_order_seq_cst) != 0)
+    {
+        std::atomic<uint32_t>& slot = m_slots[next % SLOTS];
+        slot.fetch_add(1, std::memory_order_seq_cst);
+        // Usually a single waiter parks on a slot, the others (tickets SLOTS apart) re-park
+        futex::wakeAll(slot);
+    }
+}
+
+
+inline void spin_mutex::Park(uint32_t ticket)
+{
+    std::atomic<uint32_t>& slot = m_slots[ticket % SLOTS];
+
+    m_parked.fetch_add(1, std::memory_order_seq_cst);
+    for (;;)
+    {
+        const uint32_t wakeups = slot.load(std::memory_order_seq_cst);
+        if (m_serving.load(std::memory_order_seq_cst) == ticket)
+        {
+            break;
+        }
+        futex::wait(slot, wakeups);
+    }
+    // The seq_cst load of m_serving acquired the critical section of the previous holder
+    m_parked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__spin_mutex__
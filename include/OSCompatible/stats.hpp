@@ -0,0 +1,235 @@
+/**
+ * @file stats.hpp
+ *
+ * @brief Per-thread runtime statistics from the kernel (CPU time, context
+ * switches, page faults, last CPU and migrations), for single threads and
+ * aggregated per profile over the live thread registry.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __stats__
+#define __stats__
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <ctime>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/registry.hpp"
+
+#ifndef _WIN32
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+
+namespace OSCompatible
+{
+namespace stats
+{
+
+
+/**
+ * @brief Statistics of the threads sharing a name (profile).
+ */
+struct Aggregate
+{
+    size_t threads;
+    thread::Stats total;    // Sums of the counters, tid and lastCpu are not meaningful
+};
+
+
+/**
+ * @brief Reads the statistics of a thread of this process.
+ *
+ * @param tid Kernel thread id.
+ * @return The statistics, all zeros (and tid 0) if the thread doesn't exist.
+ */
+inline thread::Stats read(long tid)
+{
+    thread::Stats stats = {0, 0, 0, 0, 0, 0, -1, 0};
+
+    if (tid == 0)
+    {
+        return stats;
+    }
+
+#ifdef _WIN32
+    HANDLE handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(tid));
+    if (handle == nullptr)
+    {
+        return stats;
+    }
+
+    FILETIME creation, exit, kernel, user;
+    if (GetThreadTimes(handle, &creation, &exit, &kernel, &user))
+    {
+        auto toNs = [](const FILETIME& time)
+        {
+            return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 100;
+        };
+        stats.tid = tid;
+        stats.cpuTimeNs = toNs(kernel) + toNs(user);
+    }
+    CloseHandle(handle);
+#else
+    const std::string dir = "/proc/self/task/" + std::to_string(tid);
+
+    // Fields after the "(comm)" of the stat file, starting with field 3 (state)
+    std::ifstream statFile(dir + "/stat");
+    std::string stat;
+    if (!std::getline(statFile, stat))
+    {
+        return stats;
+    }
+
+    stats.tid = tid;
+
+    std::istringstream fields(stat.substr(stat.rfind(')') + 2));
+    std::string field;
+    for (int index = 3; fields >> field; ++index)
+    {
+        if (index == 10)
+        {
+            stats.minorFaults = std::stoull(field);
+        }
+        else if (index == 12)
+        {
+            stats.majorFaults = std::stoull(field);
+        }
+        else if (index == 39)
+        {
+            stats.lastCpu = std::stoi(field);
+            break;
+        }
+    }
+
+    std::ifstream status(dir + "/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 24, "voluntary_ctxt_switches:") == 0)
+        {
+            stats.voluntarySwitches = std::stoull(line.substr(24));
+        }
+        else if (line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0)
+        {
+            stats.involuntarySwitches = std::stoull(line.substr(27));
+        }
+    }
+
+    std::ifstream sched(dir + "/sched");
+    while (std::getline(sched, line))
+    {
+        if (line.compare(0, 16, "se.nr_migrations") == 0)
+        {
+            stats.migrations = std::stoull(line.substr(line.find(':') + 1));
+            break;
+        }
+    }
+
+    // Per-thread CPU clock of another thread: MAKE_THREAD_CPUCLOCK(tid, CPUCLOCK_SCHED)
+    clockid_t clock = static_cast<clockid_t>((~static_cast<unsigned int>(tid) << 3) | 6);
+    struct timespec time;
+    if (clock_gettime(clock, &time) == 0)
+    {
+        stats.cpuTimeNs = static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<uint64_t>(time.tv_nsec);
+    }
+#endif
+
+    return stats;
+}
+
+
+/**
+ * @brief Statistics of the calling thread without reading procfs
+ * (CLOCK_THREAD_CPUTIME_ID, getrusage(RUSAGE_THREAD) and sched_getcpu),
+ * migrations are not available this way and stay 0.
+ */
+inline thread::Stats self()
+{
+    thread::Stats stats = {registry::currentTid(), 0, 0, 0, 0, 0, -1, 0};
+
+#ifdef _WIN32
+    stats = read(stats.tid);
+#else
+    struct timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+    {
+        stats.cpuTimeNs = static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<uint64_t>(time.tv_nsec);
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        stats.voluntarySwitches = static_cast<uint64_t>(usage.ru_nvcsw);
+        stats.involuntarySwitches = static_cast<uint64_t>(usage.ru_nivcsw);
+        stats.minorFaults = static_cast<uint64_t>(usage.ru_minflt);
+        stats.majorFaults = static_cast<uint64_t>(usage.ru_majflt);
+    }
+
+    stats.lastCpu = sched_getcpu();
+#endif
+
+    return stats;
+}
+
+
+/**
+ * @brief Statistics of the live registered threads, summed per thread name
+ * (threads created from a profile are named after it).
+ */
+inline std::map<std::string, Aggregate> byProfile()
+{
+    std::map<std::string, Aggregate> result;
+
+    for (const auto& entry : registry::snapshot())
+    {
+        thread::Stats stats = read(entry.tid);
+        if (stats.tid == 0)
+        {
+            continue; // finished meanwhile
+        }
+
+        auto it = result.find(entry.name);
+        if (it == result.end())
+        {
+            it = result.emplace(entry.name, Aggregate{0, {0, 0, 0, 0, 0, 0, -1, 0}}).first;
+        }
+
+        Aggregate& aggregate = it->second;
+        ++aggregate.threads;
+        aggregate.total.cpuTimeNs += stats.cpuTimeNs;
+        aggregate.total.voluntarySwitches += stats.voluntarySwitches;
+        aggregate.total.involuntarySwitches += stats.involuntarySwitches;
+        aggregate.total.minorFaults += stats.minorFaults;
+        aggregate.total.majorFaults += stats.majorFaults;
+        aggregate.total.migrations += stats.migrations;
+    }
+
+    return result;
+}
+
+
+} // namespace stats
+
+
+
+// Runtime statistics of the thread class
+
+inline thread::Stats thread::stats() const
+{
+    return stats::read(nativeTid());
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__stats__
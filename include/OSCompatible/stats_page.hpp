@@ -0,0 +1,627 @@
+/**
+ * @file stats_page.hpp
+ *
+ * @brief Per-thread counters published in a memory-mapped file under
+ * /dev/shm, so an external monitoring agent can sample them at high
+ * frequency without calling into the process and without syscalls in the
+ * workers.
+ *
+ * The page is a 64 bytes header followed by one 64 bytes (cache line) slot
+ * per thread. Each slot is written only by its owning thread and protected by
+ * a seqlock, readers retry a slot that changed while being copied, a bounded
+ * number of times: a process that died in the middle of an update leaves its
+ * slot odd for good.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __stats_page__
+#define __stats_page__
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/registry.hpp"
+#include "OSCompatible/idle_strategy.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+class stats_slot;
+
+
+/**
+ * @brief Shared-memory page of per-thread counters.
+ *
+ * @code
+ * // worker process
+ * OSCompatible::stats_page page("oscompatible-matcher");   // /dev/shm/oscompatible-matcher
+ * OSCompatible::thread worker([&page]()
+ * {
+ *     OSCompatible::stats_slot stats = page.attach();
+ *     while (running)
+ *     {
+ *         stats.taskDone();
+ *         stats.queueDepth(queue.size());
+ *         stats.heartbeat();
+ *     }
+ * });
+ *
+ * // monitoring process
+ * auto page = OSCompatible::stats_page::open("oscompatible-matcher");
+ * for (const auto& entry : page->snapshot()) { ... }
+ * @endcode
+ *
+ * @note Linux only, on Windows the page is not created and the slots
+ * discard the updates.
+ */
+class stats_page
+{
+public:
+    static constexpr uint32_t MAGIC = 0x4F534350;   // "OSCP"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t NAME_SIZE = 16;
+
+    // First cache line of the page
+    struct alignas(64) Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;          // Number of slots after the header
+        uint32_t slotSize;          // sizeof(Slot)
+        int64_t pid;                // Process publishing the counters
+        int64_t createdNs;          // CLOCK_MONOTONIC
+    };
+
+    // One cache line per thread, written only by the owning thread. The
+    // fields are relaxed atomic words, so a reader racing with the owner is
+    // well defined and retries.
+    struct alignas(64) Slot
+    {
+        std::atomic<uint32_t> sequence;     // Odd while the owner writes
+        std::atomic<int32_t> tid;           // 0 for a free slot
+        std::atomic<uint64_t> name[NAME_SIZE / sizeof(uint64_t)];
+        std::atomic<uint64_t> tasks;        // Tasks run
+        std::atomic<uint64_t> wakeups;
+        std::atomic<uint64_t> cpuTimeNs;    // Thread CPU time at the last cpuTime() update
+        std::atomic<int64_t> heartbeatNs;   // CLOCK_MONOTONIC of the last heartbeat
+        std::atomic<uint32_t> queueDepth;
+        uint32_t reserved;
+    };
+
+    static_assert(sizeof(Header) == 64, "the header is one cache line");
+    static_assert(sizeof(Slot) == 64, "a slot is one cache line");
+    static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "slot words are shared with other processes");
+
+    // Copies of a slot tried before it is reported torn
+    static constexpr uint32_t READ_ATTEMPTS = 256;
+
+    // Consistent copy of a slot
+    struct Entry
+    {
+        long tid;
+        std::string name;
+        uint64_t tasks;
+        uint64_t wakeups;
+        uint64_t cpuTimeNs;
+        int64_t heartbeatNs;
+        uint32_t queueDepth;
+        bool torn;      // The owner never finished its update (died or stalled in it), the counters may be mixed
+    };
+
+    /**
+     * @brief Creates (or replaces) the page /dev/shm/<name> of this process.
+     *
+     * @param name File name in /dev/shm, without slashes.
+     * @param capacity Number of threads that can attach at the same time.
+     */
+    explicit stats_page(const std::string& name, size_t capacity = 256);
+
+    // Unmaps the page, the owner also removes the file
+    ~stats_page();
+
+    stats_page(const stats_page&) = delete;
+    stats_page& operator=(const stats_page&) = delete;
+
+    // Maps an existing page read-only, for the monitoring side
+    static std::unique_ptr<stats_page> open(const std::string& name);
+
+    /**
+     * @brief Claims a slot for the calling thread.
+     *
+     * @param threadName Name of the slot, empty for the thread name.
+     * @throw std::runtime_error if the page is read-only or full.
+     */
+    stats_slot attach(const std::string& threadName = "");
+
+    // Copies the attached slots, retrying the ones being written, never blocks
+    std::vector<Entry> snapshot() const;
+
+    const Header& header() const;
+
+    // CLOCK_MONOTONIC in nanoseconds, the clock of the heartbeats
+    static int64_t now();
+
+private:
+    struct ReadOnly {};
+
+    stats_page(ReadOnly, const std::string& name);
+
+    Slot* Slots() const;
+    void Map(int fd, size_t size, bool writable);
+
+    std::string m_name;
+    bool m_owner;
+    void* m_memory;
+    size_t m_size;
+};
+
+
+/**
+ * @brief Slot of the calling thread in a stats page, released when destroyed.
+ *
+ * Updates are plain stores inside the slot seqlock, only the thread that
+ * attached the slot may update it.
+ */
+class stats_slot
+{
+public:
+    stats_slot(stats_slot&& other) noexcept;
+    stats_slot& operator=(stats_slot&& other) noexcept;
+    ~stats_slot();
+
+    stats_slot(const stats_slot&) = delete;
+    stats_slot& operator=(const stats_slot&) = delete;
+
+    void taskDone(uint64_t count = 1);
+    void wakeup();
+    void queueDepth(size_t depth);
+
+    // Stores the current CLOCK_MONOTONIC time (vDSO, no syscall)
+    void heartbeat();
+
+    // Stores the thread CPU time, this one costs a clock_gettime syscall
+    void cpuTime();
+
+    // Releases the slot, the thread can be attached again
+    void release();
+
+private:
+    friend class stats_page;
+
+    explicit stats_slot(stats_page::Slot* slot);
+
+    void BeginWrite();
+    void EndWrite();
+
+    stats_page::Slot* m_slot;
+};
+
+
+
+inline int64_t stats_page::now()
+{
+#ifdef _WIN32
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+#endif
+}
+
+
+inline void stats_page::Map(int fd, size_t size, bool writable)
+{
+#ifndef _WIN32
+    void* memory = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("Failed to map stats page " + m_name + ": " + std::string(strerror(err)));
+    }
+    close(fd);
+
+    m_memory = memory;
+    m_size = size;
+#else
+    (void)fd;
+    (void)size;
+    (void)writable;
+#endif
+}
+
+
+inline stats_page::stats_page(const std::string& name, size_t capacity)
+    :
+    m_name(name),
+    m_owner(true),
+    m_memory(nullptr),
+    m_size(0)
+{
+#ifndef _WIN32
+    const std::string path = "/" + name;
+    const size_t size = sizeof(Header) + capacity * sizeof(Slot);
+
+    int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to create stats page " + name + ": " + std::string(strerror(errno)));
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        int err = errno;
+        close(fd);
+        shm_unlink(path.c_str());
+        throw std::runtime_error("Failed to size stats page " + name + ": " + std::string(strerror(err)));
+    }
+
+    try
+    {
+        Map(fd, size, true);
+    }
+    catch (...)
+    {
+        shm_unlink(path.c_str());
+        throw;
+    }
+
+    // The file is zero filled: all the slots are free. Publish the header last
+    // so a reader seeing the magic sees the whole layout.
+    Header* header = static_cast<Header*>(m_memory);
+    header->version = VERSION;
+    header->capacity = static_cast<uint32_t>(capacity);
+    header->slotSize = static_cast<uint32_t>(sizeof(Slot));
+    header->pid = static_cast<int64_t>(getpid());
+    header->createdNs = now();
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MAGIC;
+#else
+    (void)capacity;
+#endif
+}
+
+
+inline stats_page::stats_page(ReadOnly, const std::string& name)
+    :
+    m_name(name),
+    m_owner(false),
+    m_memory(nullptr),
+    m_size(0)
+{
+#ifndef _WIN32
+    const std::string path = "/" + name;
+
+    int fd = shm_open(path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open stats page " + name + ": " + std::string(strerror(errno)));
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(Header))
+    {
+        close(fd);
+        throw std::runtime_error("Failed to open stats page " + name + ": not a stats page");
+    }
+
+    Map(fd, static_cast<size_t>(status.st_size), false);
+
+    const Header& mapped = header();
+    if (mapped.magic != MAGIC || mapped.version != VERSION || mapped.slotSize != sizeof(Slot) ||
+        sizeof(Header) + mapped.capacity * sizeof(Slot) > m_size)
+    {
+        munmap(m_memory, m_size);
+        throw std::runtime_error("Failed to open stats page " + name + ": unknown layout");
+    }
+#endif
+}
+
+
+inline std::unique_ptr<stats_page> stats_page::open(const std::string& name)
+{
+    return std::unique_ptr<stats_page>(new stats_page(ReadOnly{}, name));
+}
+
+
+inline stats_page::~stats_page()
+{
+#ifndef _WIN32
+    if (m_memory != nullptr)
+    {
+        munmap(m_memory, m_size);
+    }
+    if (m_owner)
+    {
+        shm_unlink(("/" + m_name).c_str());
+    }
+#endif
+}
+
+
+inline const stats_page::Header& stats_page::header() const
+{
+    static const Header empty = {};
+    return m_memory != nullptr ? *static_cast<const Header*>(m_memory) : empty;
+}
+
+
+inline stats_page::Slot* stats_page::Slots() const
+{
+    return reinterpret_cast<Slot*>(static_cast<char*>(m_memory) + sizeof(Header));
+}
+
+
+inline stats_slot stats_page::attach(const std::string& threadName)
+{
+    if (!m_owner)
+    {
+        throw std::runtime_error("Failed to attach to stats page " + m_name + ": page is read-only");
+    }
+    if (m_memory == nullptr)
+    {
+        return stats_slot(nullptr); // Windows, updates are discarded
+    }
+
+    const int32_t tid = static_cast<int32_t>(registry::currentTid());
+    Slot* slots = Slots();
+
+    for (uint32_t i = 0; i < header().capacity; ++i)
+    {
+        int32_t expected = 0;
+        if (slots[i].tid.load(std::memory_order_relaxed) != 0 ||
+            !slots[i].tid.compare_exchange_strong(expected, tid, std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        stats_slot slot(&slots[i]);
+        slot.BeginWrite();
+
+        Slot& s = slots[i];
+        std::string name = threadName;
+#ifndef _WIN32
+        if (name.empty())
+        {
+            char current[NAME_SIZE] = {0};
+            pthread_getname_np(pthread_self(), current, sizeof(current));
+            name = current;
+        }
+#endif
+        uint64_t words[NAME_SIZE / sizeof(uint64_t)] = {0};
+        std::memcpy(words, name.c_str(), std::min(name.size(), NAME_SIZE - 1));
+        for (size_t word = 0; word < NAME_SIZE / sizeof(uint64_t); ++word)
+        {
+            s.name[word].store(words[word], std::memory_order_relaxed);
+        }
+        s.tasks.store(0, std::memory_order_relaxed);
+        s.wakeups.store(0, std::memory_order_relaxed);
+        s.cpuTimeNs.store(0, std::memory_order_relaxed);
+        s.heartbeatNs.store(now(), std::memory_order_relaxed);
+        s.queueDepth.store(0, std::memory_order_relaxed);
+
+        slot.EndWrite();
+        return slot;
+    }
+
+    throw std::runtime_error("Failed to attach to stats page " + m_name + ": all " +
+                             std::to_string(header().capacity) + " slots are used");
+}
+
+
+inline std::vector<stats_page::Entry> stats_page::snapshot() const
+{
+    std::vector<Entry> entries;
+    if (m_memory == nullptr)
+    {
+        return entries;
+    }
+
+    Slot* slots = Slots();
+    for (uint32_t i = 0; i < header().capacity; ++i)
+    {
+        Slot& slot = slots[i];
+        Entry entry;
+        uint64_t name[NAME_SIZE / sizeof(uint64_t)];
+
+        // A slot still changing after all the attempts is copied as it is and flagged
+        for (uint32_t attempt = 0; ; ++attempt)
+        {
+            const uint32_t before = slot.sequence.load(std::memory_order_acquire);
+
+            for (size_t word = 0; word < NAME_SIZE / sizeof(uint64_t); ++word)
+            {
+                name[word] = slot.name[word].load(std::memory_order_relaxed);
+            }
+            entry.tasks = slot.tasks.load(std::memory_order_relaxed);
+            entry.wakeups = slot.wakeups.load(std::memory_order_relaxed);
+            entry.cpuTimeNs = slot.cpuTimeNs.load(std::memory_order_relaxed);
+            entry.heartbeatNs = slot.heartbeatNs.load(std::memory_order_relaxed);
+            entry.queueDepth = slot.queueDepth.load(std::memory_order_relaxed);
+            entry.tid = slot.tid.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            entry.torn = (before & 1) != 0 || slot.sequence.load(std::memory_order_relaxed) != before;
+            if (!entry.torn || entry.tid == 0 || attempt + 1 >= READ_ATTEMPTS)
+            {
+                break;
+            }
+
+            // The owner is writing: a few pauses, then let it run if it shares the CPU
+            if (attempt < READ_ATTEMPTS / 2)
+            {
+                idle::pause();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        if (entry.tid != 0)
+        {
+            char text[NAME_SIZE];
+            std::memcpy(text, name, NAME_SIZE);
+            text[NAME_SIZE - 1] = '\0';
+            entry.name = text;
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    return entries;
+}
+
+
+
+inline stats_slot::stats_slot(stats_page::Slot* slot)
+    :
+    m_slot(slot)
+{ }
+
+
+inline stats_slot::stats_slot(stats_slot&& other) noexcept
+    :
+    m_slot(other.m_slot)
+{
+    other.m_slot = nullptr;
+}
+
+
+inline stats_slot& stats_slot::operator=(stats_slot&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_slot = other.m_slot;
+        other.m_slot = nullptr;
+    }
+    return *this;
+}
+
+
+inline stats_slot::~stats_slot()
+{
+    release();
+}
+
+
+inline void stats_slot::release()
+{
+    if (m_slot != nullptr)
+    {
+        m_slot->tid.store(0, std::memory_order_release);
+        m_slot = nullptr;
+    }
+}
+
+
+inline void stats_slot::BeginWrite()
+{
+    m_slot->sequence.store(m_slot->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+
+inline void stats_slot::EndWrite()
+{
+    m_slot->sequence.store(m_slot->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+inline void stats_slot::taskDone(uint64_t count)
+{
+    if (m_slot == nullptr)
+    {
+        return;
+    }
+    BeginWrite();
+    m_slot->tasks.store(m_slot->tasks.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    EndWrite();
+}
+
+
+inline void stats_slot::wakeup()
+{
+    if (m_slot == nullptr)
+    {
+        return;
+    }
+    BeginWrite();
+    m_slot->wakeups.store(m_slot->wakeups.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    EndWrite();
+}
+
+
+inline void stats_slot::queueDepth(size_t depth)
+{
+    if (m_slot == nullptr)
+    {
+        return;
+    }
+    BeginWrite();
+    m_slot->queueDepth.store(static_cast<uint32_t>(depth), std::memory_order_relaxed);
+    EndWrite();
+}
+
+
+inline void stats_slot::heartbeat()
+{
+    if (m_slot == nullptr)
+    {
+        return;
+    }
+    const int64_t time = stats_page::now();
+    BeginWrite();
+    m_slot->heartbeatNs.store(time, std::memory_order_relaxed);
+    EndWrite();
+}
+
+
+inline void stats_slot::cpuTime()
+{
+    if (m_slot == nullptr)
+    {
+        return;
+    }
+
+#ifndef _WIN32
+    struct timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+    {
+        return;
+    }
+    BeginWrite();
+    m_slot->cpuTimeNs.store(static_cast<uint64_t>(time.tv_sec) * 1000000000ULL + static_cast<uint64_t>(time.tv_nsec),
+                            std::memory_order_relaxed);
+    EndWrite();
+#endif
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__stats_page__
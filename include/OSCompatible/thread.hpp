@@ -17,7 +17,11 @@
 #include <functional>
 #include <future>
 #include <any>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include <stdexcept>
 
@@ -25,12 +29,19 @@
 #include <windows.h>
 #else               // Linux
 #include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h> // setpriority (per-thread nice)
+#include <unistd.h>       // gettid
+#include <sys/syscall.h>  // SYS_ioprio_set, SYS_sched_setattr
+#include <sys/prctl.h>    // PR_SET_TIMERSLACK
 #endif
 
 
 namespace OSCompatible
 {
 
+class profile;
+class perf_counters;
 
 /**
  * @brief Class to manage OS-compatible threads with priority, policy, and CPU 
@@ -70,13 +81,60 @@ public:
         int priority;
         int policy;
         std::vector<bool> affinity; // CPU affinity (CPU cores to which the thread pinned and will be running on)
+        int nice = DEFAULT_NICE;    // Per-thread nice value [-20, 19], applied inside the new thread (Linux only)
+        int ioPriorityClass = DEFAULT_IO_PRIORITY_CLASS; // I/O scheduling class (IO_*_CLASS), Linux only
+        int ioPriorityLevel = DEFAULT_IO_PRIORITY_LEVEL; // I/O priority level inside the class [0(highest), 7(lowest)]
+        long timerSlack = DEFAULT_TIMER_SLACK;  // Timer slack in nanoseconds, larger values coalesce timer wakeups (Linux only)
+        int utilMin = DEFAULT_UTIL_CLAMP;       // Utilization clamp [0, 1024], boosts the CPU frequency/core choice (Linux only)
+        int utilMax = DEFAULT_UTIL_CLAMP;       // Utilization clamp [0, 1024], caps the CPU frequency/core choice (Linux only)
+        size_t stackSize = DEFAULT_STACK_SIZE;  // Stack size in bytes of the new thread
+        int numaNode = DEFAULT_NUMA_NODE;       // NUMA node preferred for the thread memory allocations (Linux only)
+        std::string name = "";                  // Thread name (Linux shows the first 15 characters), empty keeps the inherited one
+        bool perfCounters = false;              // Open performance counters for the thread at spawn, @see counters() (Linux only)
+        long samplingPeriod = DEFAULT_SAMPLING_PERIOD; // Thread CPU time in microseconds between stack samples, @see sampler.hpp (Linux only)
     };
 
     static const int DEFAULT_PRIORITY;
     static const int DEFAULT_POLICY;
+    static const int DEFAULT_NICE;
+    static const int DEFAULT_IO_PRIORITY_CLASS; // Keep the inherited I/O priority
+    static const int DEFAULT_IO_PRIORITY_LEVEL;
+    static const long DEFAULT_TIMER_SLACK;      // Keep the inherited timer slack
+    static const int DEFAULT_UTIL_CLAMP;        // Keep the inherited utilization clamp
+    static const int MAX_UTIL_CLAMP;            // 1024 - full CPU capacity
+    static const size_t DEFAULT_STACK_SIZE;     // System default stack size
+    static const int DEFAULT_NUMA_NODE;         // Keep the inherited memory policy
+    static const long DEFAULT_SAMPLING_PERIOD;  // The thread is not sampled
     static const std::vector<bool> DEFAULT_AFFINITY; // No CPU affinity (thread will be running on all available CPU cores)
     static const Properties DEFAULT_PROPERTIES;
 
+    // Background scheduling classes, their static priority is always 0 so
+    // keep priority as DEFAULT_PRIORITY (or 0) when using them.
+    // SCHED_BATCH - CPU bound work that should not preempt interactive threads.
+    // SCHED_IDLE  - runs only when nothing else wants the CPU.
+    // On Windows policies are not supported, so both equal DEFAULT_POLICY.
+    static const int BATCH_POLICY;
+    static const int IDLE_POLICY;
+
+    // I/O scheduling classes (ioprio_set), honored by I/O schedulers like BFQ.
+    // IO_REALTIME_CLASS    - always served first, needs CAP_SYS_ADMIN.
+    // IO_BEST_EFFORT_CLASS - the default class, level orders threads inside it.
+    // IO_IDLE_CLASS        - served only when no other thread does disk I/O.
+    static const int IO_REALTIME_CLASS;
+    static const int IO_BEST_EFFORT_CLASS;
+    static const int IO_IDLE_CLASS;
+
+    /**
+     * @brief Builds properties for a background thread (compaction, checksum, 
+     * scrubbing...) that should never preempt latency sensitive threads.
+     *
+     * @param policy BATCH_POLICY or IDLE_POLICY.
+     * @param nice Per-thread nice value, DEFAULT_NICE keeps the inherited one.
+     * @param affinity CPU cores the thread should run on.
+     */
+    static Properties BackgroundProperties(int policy = IDLE_POLICY, int nice = DEFAULT_NICE,
+                                           const std::vector<bool>& affinity = DEFAULT_AFFINITY);
+
 
     /**
      * @brief Default constructor for the thread class.
@@ -200,6 +258,43 @@ public:
     thread(const Properties& properties, Function&& func, Args&&... args);
 
 
+    /**
+     * @brief Constructor for the thread class that takes a named profile (see
+     * profile.hpp), the function and its arguments.
+     *
+     * The profile properties are resolved once when the profile is loaded, and
+     * the pthread attributes built from them are reused for every thread so
+     * spawning doesn't pay for building the attributes again.
+     *
+     * @param threadProfile The profile the thread is created with, @see profile::find
+     * @param func The function to be executed in the new thread.
+     * @param args The arguments to be passed to the function.
+     *
+     * @throws std::runtime_error If the thread cannot be created or the profile
+     * properties can't be set.
+     */
+    template <typename Function, typename... Args>
+    thread(const profile& threadProfile, Function&& func, Args&&... args);
+
+
+    /**
+     * @brief Constructor for the thread class that takes a profile name, the
+     * function and its arguments.
+     *
+     * @param profileName Name of a loaded profile ("ingest", "matcher", "gc"...)
+     * @param func The function to be executed in the new thread.
+     * @param args The arguments to be passed to the function.
+     *
+     * @throws std::runtime_error If the profile doesn't exist, the thread cannot
+     * be created or the profile properties can't be set.
+     *
+     * @note The lookup by name takes a lock, keep the result of profile::find
+     * and use the profile constructor on hot spawning paths.
+     */
+    template <typename Function, typename... Args>
+    thread(const std::string& profileName, Function&& func, Args&&... args);
+
+
     // Deleting copy constructor and assignment operator
     thread(const thread&) = delete;
     thread& operator=(const thread&) = delete;
@@ -302,10 +397,129 @@ public:
     std::any getResult();
 
 
+    /**
+     * @brief Ties the lifetime of a resource to the thread object, e.g. a
+     * core_lease whose CPUs the thread is pinned to.
+     *
+     * Held resources are released on join() or when the thread object is
+     * destroyed.
+     *
+     * @param resource The resource, moved into the thread object.
+     */
+    template <typename Resource>
+    void hold(Resource&& resource);
+
+
+    /**
+     * @brief Runtime statistics of a thread as reported by the kernel.
+     */
+    struct Stats
+    {
+        long tid;                       // Kernel thread id, 0 if the thread didn't start yet
+        uint64_t cpuTimeNs;             // CPU time consumed (CLOCK_THREAD_CPUTIME_ID)
+        uint64_t voluntarySwitches;     // Context switches because the thread blocked
+        uint64_t involuntarySwitches;   // Context switches because the thread was preempted
+        uint64_t minorFaults;
+        uint64_t majorFaults;
+        int lastCpu;                    // CPU the thread last ran on, -1 if unknown
+        uint64_t migrations;            // Migrations between CPUs (needs CONFIG_SCHED_DEBUG, 0 otherwise)
+    };
+
+
+    /**
+     * @brief Reads the runtime statistics of the thread on demand (see stats.hpp).
+     *
+     * @note Linux reads them from /proc/self/task/<tid>, Windows fills only
+     * the CPU time.
+     *
+     * @return The statistics, all zeros if the thread didn't start yet or
+     * already finished.
+     */
+    Stats stats() const;
+
+    // Kernel tid of the thread, 0 if the thread didn't start yet
+    long nativeTid() const;
+
+
+    /**
+     * @brief Performance counters opened at spawn (Properties::perfCounters),
+     * see perf_counters.hpp.
+     *
+     * @return The counters, nullptr if they were not requested.
+     */
+    std::shared_ptr<perf_counters> counters() const;
+
+
 private:
+    friend class profile;
+    friend class registry;
+    friend class perf_counters;
+    friend class sampler;
+    friend class tracer;
+    friend class pi_mutex;
+
+    #ifdef _WIN32       // Windows
+    typedef void            nativeAttributes;
+    #else               // Linux
+    typedef pthread_attr_t  nativeAttributes;
+    #endif
+
+    // Attributes already built from the properties (by a profile), or nullptr
+    // to build them while creating the thread
+    struct PrebuiltAttributes
+    {
+        const nativeAttributes* attributes;
+    };
+
+    template <typename Function, typename... Args>
+    thread(PrebuiltAttributes prebuilt, const Properties& properties, Function&& func, Args&&... args);
+
+#ifdef _WIN32
     void SetPriority(const Properties& properties);
     void SetPolicy(const Properties& properties);
     void SetAffinity(const Properties& properties);
+#else   // Unix (Linux), properties are set on the attributes the thread is created with
+    static void SetPriority(const Properties& properties, pthread_attr_t* attr);
+    static void SetPolicy(const Properties& properties, pthread_attr_t* attr);
+    static void SetAffinity(const Properties& properties, pthread_attr_t* attr);
+    static void SetStackSize(const Properties& properties, pthread_attr_t* attr);
+
+    // Initializes attr with all the properties, on success attr must be
+    // destroyed by the caller (pthread_attr_destroy)
+    static void InitAttributes(const Properties& properties, pthread_attr_t* attr);
+#endif
+
+    // Properties that can only be applied by the new thread itself (nice,
+    // I/O priority, timer slack, NUMA node, utilization clamp,
+    // SCHED_BATCH/SCHED_IDLE), called from the new thread before the user function.
+    static bool HasInThreadProperties(const Properties& properties);
+    static void ApplyInThreadProperties(const Properties& properties);
+
+    // Names the calling (new) thread, can't fail once truncated: the
+    // constructor doesn't wait for it
+    static void SetName(const Properties& properties);
+
+    // Kernel tid of the calling thread (Windows thread id)
+    static long CurrentTid();
+
+    // Opens the performance counters of the calling (new) thread into m_counters
+    void OpenPerfCounters();
+
+    // Sampling profiler hooks of the calling (new) thread (see sampler.hpp)
+    static void StartSampling(const Properties& properties);
+    static void StopSampling();
+
+    // Lifecycle tracer hooks (see tracer.hpp), begin is 0 while tracing is
+    // disabled and then nothing is recorded
+    static int64_t TraceBegin();
+    static uint64_t TraceFlow();
+    static void TraceEnd(const char* event, int64_t begin, uint64_t flow = 0, long target = 0);
+    static void TraceInstant(const char* event, long target);
+
+    // Live thread registry hooks, called from the new thread (see registry.hpp)
+    static size_t RegisterThread(const Properties& properties);
+    static void SetThreadRunning(size_t slot);
+    static void UnregisterThread(size_t slot);
 
 
     // Wrapper function to be passed to pthread_create
@@ -333,6 +547,9 @@ private:
     std::shared_ptr<std::promise<std::any>> m_promise;
     std::future<std::any> m_future;
     Properties m_properties; // Additional properties for the thread, if needed
+    std::shared_ptr<std::atomic<long>> m_tid; // Kernel tid, published by the new thread when it starts
+    std::shared_ptr<perf_counters> m_counters; // Set by the new thread before the constructor returns
+    std::vector<std::shared_ptr<void>> m_resources; // Released on join, @see hold
 
 };
 
@@ -340,9 +557,39 @@ private:
 
 const int thread::DEFAULT_PRIORITY = 255;
 const int thread::DEFAULT_POLICY = 255;
+const int thread::DEFAULT_NICE = 255;
+const int thread::DEFAULT_IO_PRIORITY_CLASS = 255;
+const int thread::DEFAULT_IO_PRIORITY_LEVEL = 4; // Kernel default level of the best effort class
+const long thread::DEFAULT_TIMER_SLACK = -1;      // 0 is a valid value (resets the slack to the default one)
+const int thread::DEFAULT_UTIL_CLAMP = -1;
+const int thread::MAX_UTIL_CLAMP = 1024;
+const size_t thread::DEFAULT_STACK_SIZE = 0;
+const int thread::DEFAULT_NUMA_NODE = -1;
+const long thread::DEFAULT_SAMPLING_PERIOD = 0;
 const std::vector<bool>  thread::DEFAULT_AFFINITY = {}; // No CPU affinity (thread will be running on all available CPU cores)
 const thread::Properties thread::DEFAULT_PROPERTIES = {DEFAULT_PRIORITY, DEFAULT_POLICY, DEFAULT_AFFINITY};
 
+#ifdef _WIN32
+const int thread::BATCH_POLICY = DEFAULT_POLICY;
+const int thread::IDLE_POLICY = DEFAULT_POLICY;
+#else   // Unix (Linux)
+const int thread::BATCH_POLICY = SCHED_BATCH;
+const int thread::IDLE_POLICY = SCHED_IDLE;
+#endif
+
+// Values of the kernel IOPRIO_CLASS_* (linux/ioprio.h is not available everywhere)
+const int thread::IO_REALTIME_CLASS = 1;
+const int thread::IO_BEST_EFFORT_CLASS = 2;
+const int thread::IO_IDLE_CLASS = 3;
+
+
+thread::Properties thread::BackgroundProperties(int policy, int nice, const std::vector<bool>& affinity)
+{
+    Properties properties = {DEFAULT_PRIORITY, policy, affinity};
+    properties.nice = nice;
+    return properties;
+}
+
 
 
 thread::thread()
@@ -355,7 +602,8 @@ thread::thread()
     m_func(nullptr),
     m_promise(std::make_shared<std::promise<std::any>>()),
     m_future(m_promise->get_future()),
-    m_properties(DEFAULT_PROPERTIES)
+    m_properties(DEFAULT_PROPERTIES),
+    m_tid(std::make_shared<std::atomic<long>>(0))
 { }
 
 
@@ -376,14 +624,25 @@ thread::thread(Function&& func, Args&&... args)
     m_func(nullptr),
     m_promise(std::make_shared<std::promise<std::any>>()),
     m_future(m_promise->get_future()),
-    m_properties(DEFAULT_PROPERTIES)
+    m_properties(DEFAULT_PROPERTIES),
+    m_tid(std::make_shared<std::atomic<long>>(0))
 {
     using ReturnType = std::invoke_result_t<Function, Args...>;
 
+    const int64_t spawnBegin = TraceBegin();
+    const uint64_t flow = TraceFlow();
+
     auto boundFunc = std::bind(std::forward<Function>(func), std::forward<Args>(args)...);
 
-    m_func = [this, boundFunc]()
+    m_func = [this, boundFunc, flow, tid = m_tid]()
     {
+        const int64_t startBegin = TraceBegin();
+        tid->store(CurrentTid(), std::memory_order_release);
+        size_t slot = RegisterThread(DEFAULT_PROPERTIES);
+        SetThreadRunning(slot);
+        TraceEnd("start", startBegin, flow);
+
+        const int64_t bodyBegin = TraceBegin();
         try
         {
             if constexpr (std::is_void_v<ReturnType>)
@@ -400,6 +659,9 @@ thread::thread(Function&& func, Args&&... args)
         {
             m_promise->set_exception(std::current_exception());
         }
+        TraceEnd("body", bodyBegin);
+
+        UnregisterThread(slot);
     };
 
     auto m_funcptr = new std::function<void()>(std::move(m_func));
@@ -419,6 +681,7 @@ thread::thread(Function&& func, Args&&... args)
     }
 #endif
 
+    TraceEnd("spawn", spawnBegin, flow);
     m_initialized = true;
 }
 
@@ -431,6 +694,12 @@ thread::thread(Function&& func, Args&&... args)
 
 template <typename Function, typename... Args>
 thread::thread(const Properties& properties, Function&& func, Args&&... args)
+    : thread(PrebuiltAttributes{nullptr}, properties, std::forward<Function>(func), std::forward<Args>(args)...)
+{ }
+
+
+template <typename Function, typename... Args>
+thread::thread(PrebuiltAttributes prebuilt, const Properties& properties, Function&& func, Args&&... args)
     :
 #ifdef _WIN32
     m_handle(nullptr),
@@ -445,22 +714,34 @@ thread::thread(const Properties& properties, Function&& func, Args&&... args)
     m_func(nullptr),
     m_promise(std::make_shared<std::promise<std::any>>()),
     m_future(m_promise->get_future()),
-    m_properties(properties)
+    m_properties(properties),
+    m_tid(std::make_shared<std::atomic<long>>(0))
 {
     using ReturnType = std::invoke_result_t<Function, Args...>;
 
+    const int64_t spawnBegin = TraceBegin();
+    const uint64_t flow = TraceFlow();
+
     auto boundFunc = std::bind(std::forward<Function>(func), std::forward<Args>(args)...);
 
 
 #ifdef _WIN32
-    m_func = [this, boundFunc]()
+    m_func = [this, boundFunc, properties, flow, tid = m_tid]()
     {
+        const int64_t startBegin = TraceBegin();
+        tid->store(CurrentTid(), std::memory_order_release);
+        size_t slot = RegisterThread(properties);
+
         // must set here barrier to wait until all the properties are initialized
         std::unique_lock<std::mutex> lock(m_mutex);
         m_cv.wait(lock, [this]() { return m_releaseThread; });
 
         if(m_propertiesInitialized)
         {
+            SetThreadRunning(slot);
+            TraceEnd("start", startBegin, flow);
+
+            const int64_t bodyBegin = TraceBegin();
             try
             {
                 if constexpr (std::is_void_v<ReturnType>)
@@ -477,13 +758,18 @@ thread::thread(const Properties& properties, Function&& func, Args&&... args)
             {
                 m_promise->set_exception(std::current_exception());
             }
+            TraceEnd("body", bodyBegin);
         }
+
+        UnregisterThread(slot);
     };
 
     auto m_funcptr = new std::function<void()>(std::move(m_func));
 
+    (void)prebuilt; // windows sets the properties on the created thread
+
     // Windows-specific thread creation
-    m_handle = CreateThread(nullptr, 0, reinterpret_cast<LPTHREAD_START_ROUTINE>(threadFuncWrapper), m_funcptr, 0, nullptr);
+    m_handle = CreateThread(nullptr, static_cast<SIZE_T>(properties.stackSize), reinterpret_cast<LPTHREAD_START_ROUTINE>(threadFuncWrapper), m_funcptr, 0, nullptr);
     if (m_handle == nullptr)
     {
         throw std::runtime_error("Failed to create thread");
@@ -513,13 +799,55 @@ thread::thread(const Properties& properties, Function&& func, Args&&... args)
         throw std::runtime_error("Failed to set thread properties: " + std::string(e.what()));
     }
 
+    TraceEnd("spawn", spawnBegin, flow);
     m_initialized = true;
 
 
 #else   // Unix (Linux)
 
-    m_func = [this, boundFunc]()
+    // Properties like nice can be applied only from inside the new thread,
+    // in that case the constructor waits until the new thread reports back
+    // so the failure is thrown here like for all the other properties.
+    const bool inThreadProperties = HasInThreadProperties(properties);
+    auto applied = std::make_shared<std::promise<void>>();
+    std::future<void> appliedFuture = applied->get_future();
+
+    m_func = [this, boundFunc, applied, inThreadProperties, properties, flow, tid = m_tid]()
     {
+        const int64_t startBegin = TraceBegin();
+        tid->store(CurrentTid(), std::memory_order_release);
+        size_t slot = RegisterThread(properties);
+        SetName(properties);
+
+        if (inThreadProperties)
+        {
+            const int64_t propertiesBegin = TraceBegin();
+            try
+            {
+                ApplyInThreadProperties(properties);
+                if (properties.perfCounters)
+                {
+                    OpenPerfCounters(); // the constructor waits, so m_counters is safe to set
+                }
+                if (properties.samplingPeriod != DEFAULT_SAMPLING_PERIOD)
+                {
+                    StartSampling(properties);
+                }
+                TraceEnd("properties", propertiesBegin);
+                applied->set_value();
+            }
+            catch (...)
+            {
+                UnregisterThread(slot);
+                applied->set_exception(std::current_exception());
+                return; // Properties not setted correctly, don't call the function
+            }
+        }
+
+        SetThreadRunning(slot);
+        TraceEnd("start", startBegin, flow);
+
+        const int64_t bodyBegin = TraceBegin();
         try
         {
             if constexpr (std::is_void_v<ReturnType>)
@@ -536,32 +864,54 @@ thread::thread(const Properties& properties, Function&& func, Args&&... args)
         {
             m_promise->set_exception(std::current_exception());
         }
-    };
+        TraceEnd("body", bodyBegin);
 
-    if (pthread_attr_init(&m_attr) != 0)
-    {
-        throw std::runtime_error("Failed to initialize thread attributes: " + std::string(strerror(errno)));
-    }
-
-    // Try to set thread properties
-    SetPolicy(properties);
-    SetPriority(properties);
-    SetAffinity(properties);
+        if (properties.samplingPeriod != DEFAULT_SAMPLING_PERIOD)
+        {
+            StopSampling();
+        }
+        UnregisterThread(slot);
+    };
 
-    // Ensure the scheduling policy and priority are applied
-    if (pthread_attr_setinheritsched(&m_attr, PTHREAD_EXPLICIT_SCHED) != 0)
+    // Try to set thread properties (unless a profile already built them)
+    const pthread_attr_t* attr = prebuilt.attributes;
+    if (attr == nullptr)
     {
-        throw std::runtime_error("Failed to set inherit scheduler attribute: " + std::string(strerror(errno)));
+        InitAttributes(properties, &m_attr);
+        attr = &m_attr;
     }
 
 
     auto m_funcptr = new std::function<void()>(std::move(m_func));
 
     // POSIX-specific thread creation
-    if (pthread_create(&m_handle, nullptr, threadFuncWrapper, m_funcptr) != 0)
+    int err = pthread_create(&m_handle, attr, threadFuncWrapper, m_funcptr);
+    if (attr == &m_attr)
+    {
+        pthread_attr_destroy(&m_attr);
+    }
+    if (err != 0)
     {
-        throw std::runtime_error("Failed to create thread: " + std::string(strerror(errno)));
+        delete m_funcptr;
+        throw std::runtime_error("Failed to create thread: " + std::string(strerror(err)));
     }
+
+    if (inThreadProperties)
+    {
+        try
+        {
+            appliedFuture.get();
+        }
+        catch (std::exception& e)
+        {
+            join(); // Wait for the thread to finish
+
+            // If properties are not set correctly, throw an exception
+            throw std::runtime_error("Failed to set thread properties: " + std::string(e.what()));
+        }
+    }
+
+    TraceEnd("spawn", spawnBegin, flow);
     m_initialized = true;
 
 #endif
@@ -573,7 +923,10 @@ thread::thread(thread&& other) noexcept
     m_handle(other.m_handle),
     m_func(std::move(other.m_func)),
     m_promise(std::move(other.m_promise)),
-    m_future(std::move(other.m_future))
+    m_future(std::move(other.m_future)),
+    m_tid(std::move(other.m_tid)),
+    m_counters(std::move(other.m_counters)),
+    m_resources(std::move(other.m_resources))
 {
 #ifdef _WIN32
     other.m_handle = nullptr; // Reset the thread handle
@@ -596,6 +949,9 @@ thread& thread::operator=(thread&& other) noexcept
         m_func = std::move(other.m_func);
         m_promise = std::move(other.m_promise);
         m_future = std::move(other.m_future);
+        m_tid = std::move(other.m_tid);
+        m_counters = std::move(other.m_counters);
+        m_resources = std::move(other.m_resources);
 #ifdef _WIN32
         other.m_handle = nullptr;
 #else
@@ -608,6 +964,9 @@ thread& thread::operator=(thread&& other) noexcept
 
 void thread::join()
 {
+    const int64_t joinBegin = TraceBegin();
+    const long target = nativeTid();
+
 #ifdef _WIN32
     if (WaitForSingleObject(m_handle, INFINITE) == WAIT_FAILED)
     {
@@ -624,6 +983,13 @@ void thread::join()
     }
     m_handle = pthread_t(); // Reset the thread handle
 #endif
+    if (m_tid)
+    {
+        m_tid->store(0, std::memory_order_release); // the tid may be reused by a new thread
+    }
+    m_resources.clear();
+
+    TraceEnd("join", joinBegin, 0, target);
 }
 
 
@@ -648,6 +1014,8 @@ void thread::detach()
     
     m_handle = pthread_t(); // Reset the thread handle
 #endif
+
+    TraceInstant("detach", nativeTid());
 }
 
 
@@ -669,6 +1037,29 @@ std::any thread::getResult()
 }
 
 
+long thread::CurrentTid()
+{
+#ifdef _WIN32
+    return static_cast<long>(GetCurrentThreadId());
+#else
+    return static_cast<long>(gettid());
+#endif
+}
+
+
+long thread::nativeTid() const
+{
+    return m_tid ? m_tid->load(std::memory_order_acquire) : 0;
+}
+
+
+template <typename Resource>
+void thread::hold(Resource&& resource)
+{
+    using Held = std::decay_t<Resource>;
+    m_resources.push_back(std::make_shared<Held>(std::forward<Resource>(resource)));
+}
+
 
 
 
@@ -679,9 +1070,39 @@ std::any thread::getResult()
 
 
 
+
+#ifdef _WIN32
 void thread::SetPriority(const thread::Properties& properties)
+#else
+void thread::SetPriority(const thread::Properties& properties, pthread_attr_t* attr)
+#endif
 {
-    if (properties.priority == DEFAULT_POLICY)
+#ifndef _WIN32
+    // Non real-time policies have a single static priority of 0
+    if (properties.policy == SCHED_OTHER || properties.policy == SCHED_BATCH || properties.policy == SCHED_IDLE)
+    {
+        if (properties.priority != DEFAULT_PRIORITY && properties.priority != 0)
+        {
+            throw std::runtime_error("Failed to set thread priority: SCHED_OTHER, SCHED_BATCH and SCHED_IDLE "
+                                     "support only priority 0, use nice instead");
+        }
+
+        if (properties.policy == SCHED_OTHER)
+        {
+            struct sched_param param;
+            param.sched_priority = 0;
+
+            int err = pthread_attr_setschedparam(attr, &param);
+            if (err != 0)
+            {
+                throw std::runtime_error("Failed to set thread priority: " + std::string(strerror(err)));
+            }
+        }
+        return; // SCHED_BATCH and SCHED_IDLE priority applied inside the new thread
+    }
+#endif
+
+    if (properties.priority == DEFAULT_PRIORITY)
     {
         return; // If default priority - nothing to do (its already the default behaviour)
     }
@@ -699,7 +1120,7 @@ void thread::SetPriority(const thread::Properties& properties)
     struct sched_param param;
     param.sched_priority = properties.priority;
 
-    if (pthread_attr_setschedparam(&m_attr, &param) != 0)
+    if (pthread_attr_setschedparam(attr, &param) != 0)
     {
         throw std::runtime_error("Failed to set thread priority: " + std::string(strerror(errno)));
     }
@@ -707,7 +1128,11 @@ void thread::SetPriority(const thread::Properties& properties)
 }
 
 
+#ifdef _WIN32
 void thread::SetPolicy(const thread::Properties& properties)
+#else
+void thread::SetPolicy(const thread::Properties& properties, pthread_attr_t* attr)
+#endif
 {
     if (properties.policy == DEFAULT_POLICY)
     {
@@ -717,37 +1142,48 @@ void thread::SetPolicy(const thread::Properties& properties)
 #ifdef _WIN32
         // windows doesn't support setting policy
 #else   // Linux
-    
-    if (pthread_attr_setschedpolicy(&m_attr, m_properties.policy) != 0)
+
+    if (properties.policy == SCHED_BATCH || properties.policy == SCHED_IDLE)
     {
-        throw std::runtime_error("Failed to set thread policy: " + std::string(strerror(errno)));
+        return; // pthread attributes accept only SCHED_OTHER/FIFO/RR, applied inside the new thread
+    }
+
+    int err = pthread_attr_setschedpolicy(attr, properties.policy);
+    if (err != 0)
+    {
+        throw std::runtime_error("Failed to set thread policy: " + std::string(strerror(err)));
     }
 #endif
 }
 
+#ifdef _WIN32
 void thread::SetAffinity(const thread::Properties& properties)
+#else
+void thread::SetAffinity(const thread::Properties& properties, pthread_attr_t* attr)
+#endif
 {
     size_t coresCnt = 0;
 
-    if (!m_properties.affinity.empty())
+    if (!properties.affinity.empty())
     {
 
 #ifdef _WIN32
 
         DWORD_PTR mask = 0;
 
-        for (size_t i = 0; i < m_properties.affinity.size(); ++i)
+        for (size_t i = 0; i < properties.affinity.size(); ++i)
         {
-            if (m_properties.affinity[i])
+            if (properties.affinity[i])
             {
                 mask |= (static_cast<DWORD_PTR>(1) << i);
                 ++coresCnt;
             }
         }
 
-        if( coresCnt == m_properties.affinity.size() )
+        // Any selected CPU pins the thread: {true} is CPU 0 alone, not "all the CPUs"
+        if( coresCnt == 0 )
         {
-            return; // If all cores selected - nothing to do (its already the default behaviour)
+            return; // If no core selected - nothing to do (runs on all the cores, the default behaviour)
         }
 
         SetThreadAffinityMask(m_handle, mask);
@@ -758,23 +1194,25 @@ void thread::SetAffinity(const thread::Properties& properties)
         cpu_set_t cpuset;
         CPU_ZERO(&cpuset);
 
-        for (size_t i = 0; i < m_properties.affinity.size(); ++i)
+        for (size_t i = 0; i < properties.affinity.size(); ++i)
         {
-            if (m_properties.affinity[i])
+            if (properties.affinity[i])
             {
                 CPU_SET(i, &cpuset);
                 ++coresCnt;
             }
         }
 
-        if( coresCnt == m_properties.affinity.size() )
+        // Any selected CPU pins the thread: {true} is CPU 0 alone, not "all the CPUs"
+        if( coresCnt == 0 )
         {
-            return; // If all cores selected - nothing to do (its already the default behaviour)
+            return; // If no core selected - nothing to do (runs on all the cores, the default behaviour)
         }
 
-        if (pthread_attr_setaffinity_np(&m_attr, sizeof(cpu_set_t), &cpuset) != 0)
+        int err = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpuset);
+        if (err != 0)
         {
-            throw std::runtime_error("Failed to set thread affinity(CPU cores): " + std::string(strerror(errno)));
+            throw std::runtime_error("Failed to set thread affinity(CPU cores): " + std::string(strerror(err)));
         }
 
 #endif
@@ -782,6 +1220,209 @@ void thread::SetAffinity(const thread::Properties& properties)
 }
 
 
+#ifndef _WIN32
+void thread::SetStackSize(const thread::Properties& properties, pthread_attr_t* attr)
+{
+    if (properties.stackSize == DEFAULT_STACK_SIZE)
+    {
+        return; // If default stack size - nothing to do (its already the default behaviour)
+    }
+
+    int err = pthread_attr_setstacksize(attr, properties.stackSize);
+    if (err != 0)
+    {
+        throw std::runtime_error("Failed to set thread stack size: " + std::string(strerror(err)));
+    }
+}
+
+
+void thread::InitAttributes(const thread::Properties& properties, pthread_attr_t* attr)
+{
+    int err = pthread_attr_init(attr);
+    if (err != 0)
+    {
+        throw std::runtime_error("Failed to initialize thread attributes: " + std::string(strerror(err)));
+    }
+
+    try
+    {
+        SetPolicy(properties, attr);
+        SetPriority(properties, attr);
+        SetAffinity(properties, attr);
+        SetStackSize(properties, attr);
+
+        // Ensure the scheduling policy and priority are applied,
+        // otherwise (all defaults) keep inheriting them from the creating thread
+        bool inThreadPolicy = properties.policy == SCHED_BATCH || properties.policy == SCHED_IDLE;
+        if (!inThreadPolicy && (properties.policy != DEFAULT_POLICY || properties.priority != DEFAULT_PRIORITY))
+        {
+            err = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+            if (err != 0)
+            {
+                throw std::runtime_error("Failed to set inherit scheduler attribute: " + std::string(strerror(err)));
+            }
+        }
+    }
+    catch (...)
+    {
+        pthread_attr_destroy(attr);
+        throw;
+    }
+}
+#endif
+
+
+bool thread::HasInThreadProperties(const thread::Properties& properties)
+{
+#ifdef _WIN32
+    (void)properties;
+    return false; // Linux only properties, not supported on windows
+#else   // Unix (Linux)
+    return properties.perfCounters ||
+           properties.samplingPeriod != DEFAULT_SAMPLING_PERIOD ||
+           properties.nice != DEFAULT_NICE ||
+           properties.ioPriorityClass != DEFAULT_IO_PRIORITY_CLASS ||
+           properties.timerSlack != DEFAULT_TIMER_SLACK ||
+           properties.numaNode != DEFAULT_NUMA_NODE ||
+           properties.utilMin != DEFAULT_UTIL_CLAMP || properties.utilMax != DEFAULT_UTIL_CLAMP ||
+           properties.policy == SCHED_BATCH || properties.policy == SCHED_IDLE;
+#endif
+}
+
+
+void thread::SetName(const thread::Properties& properties)
+{
+#ifndef _WIN32
+    if (!properties.name.empty())
+    {
+        // The kernel keeps up to 15 characters (plus the terminating null)
+        std::string name = properties.name.substr(0, 15);
+        pthread_setname_np(pthread_self(), name.c_str());
+    }
+#else
+    (void)properties;
+#endif
+}
+
+
+void thread::ApplyInThreadProperties(const thread::Properties& properties)
+{
+#ifndef _WIN32
+    if (properties.policy == SCHED_BATCH || properties.policy == SCHED_IDLE)
+    {
+        struct sched_param param;
+        param.sched_priority = 0;
+
+        int err = pthread_setschedparam(pthread_self(), properties.policy, &param);
+        if (err != 0)
+        {
+            throw std::runtime_error("Failed to set thread policy: " + std::string(strerror(err)));
+        }
+    }
+
+    if (properties.nice != DEFAULT_NICE)
+    {
+        // On Linux nice is a per-thread attribute, addressed by the kernel tid
+        if (setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), properties.nice) != 0)
+        {
+            throw std::runtime_error("Failed to set thread nice: " + std::string(strerror(errno)));
+        }
+    }
+
+    if (properties.ioPriorityClass != DEFAULT_IO_PRIORITY_CLASS)
+    {
+        // IOPRIO_PRIO_VALUE(class, level), the class is stored above the 13 bits of level
+        const int ioprioWhoProcess = 1; // IOPRIO_WHO_PROCESS, a tid addresses a single thread
+        if (properties.ioPriorityLevel < 0 || properties.ioPriorityLevel > 7)
+        {
+            throw std::runtime_error("Failed to set thread I/O priority: level must be in range [0, 7]");
+        }
+
+        const int ioprio = (properties.ioPriorityClass << 13) | properties.ioPriorityLevel;
+
+        if (syscall(SYS_ioprio_set, ioprioWhoProcess, static_cast<int>(gettid()), ioprio) != 0)
+        {
+            throw std::runtime_error("Failed to set thread I/O priority: " + std::string(strerror(errno)));
+        }
+    }
+
+    if (properties.timerSlack != DEFAULT_TIMER_SLACK)
+    {
+        if (prctl(PR_SET_TIMERSLACK, static_cast<unsigned long>(properties.timerSlack), 0, 0, 0) != 0)
+        {
+            throw std::runtime_error("Failed to set thread timer slack: " + std::string(strerror(errno)));
+        }
+    }
+
+    if (properties.numaNode != DEFAULT_NUMA_NODE)
+    {
+        if (properties.numaNode < 0)
+        {
+            throw std::runtime_error("Failed to set thread NUMA node: invalid node " + std::to_string(properties.numaNode));
+        }
+
+        // set_mempolicy(MPOL_PREFERRED) applies to the calling thread only,
+        // maxnode is the number of bits in the node mask plus one
+        const int mpolPreferred = 1;
+        const size_t bitsPerWord = sizeof(unsigned long) * 8;
+        std::vector<unsigned long> nodeMask(static_cast<size_t>(properties.numaNode) / bitsPerWord + 1, 0);
+        nodeMask[static_cast<size_t>(properties.numaNode) / bitsPerWord] |= 1UL << (properties.numaNode % bitsPerWord);
+
+        if (syscall(SYS_set_mempolicy, mpolPreferred, nodeMask.data(), nodeMask.size() * bitsPerWord + 1) != 0)
+        {
+            throw std::runtime_error("Failed to set thread NUMA node: " + std::string(strerror(errno)));
+        }
+    }
+
+    if (properties.utilMin != DEFAULT_UTIL_CLAMP || properties.utilMax != DEFAULT_UTIL_CLAMP)
+    {
+        // struct sched_attr (SCHED_ATTR_SIZE_VER1), not exposed by older glibc versions
+        struct SchedAttr
+        {
+            uint32_t size;
+            uint32_t schedPolicy;
+            uint64_t schedFlags;
+            int32_t  schedNice;
+            uint32_t schedPriority;
+            uint64_t schedRuntime;
+            uint64_t schedDeadline;
+            uint64_t schedPeriod;
+            uint32_t schedUtilMin;
+            uint32_t schedUtilMax;
+        };
+
+        const uint64_t keepAll = 0x08 | 0x10;   // SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS
+        const uint64_t clampMin = 0x20;         // SCHED_FLAG_UTIL_CLAMP_MIN
+        const uint64_t clampMax = 0x40;         // SCHED_FLAG_UTIL_CLAMP_MAX
+
+        SchedAttr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.schedFlags = keepAll;
+
+        if (properties.utilMin != DEFAULT_UTIL_CLAMP)
+        {
+            attr.schedFlags |= clampMin;
+            attr.schedUtilMin = static_cast<uint32_t>(properties.utilMin);
+        }
+        if (properties.utilMax != DEFAULT_UTIL_CLAMP)
+        {
+            attr.schedFlags |= clampMax;
+            attr.schedUtilMax = static_cast<uint32_t>(properties.utilMax);
+        }
+
+        // pid 0 - the calling (new) thread
+        if (syscall(SYS_sched_setattr, 0, &attr, 0) != 0)
+        {
+            throw std::runtime_error("Failed to set thread utilization clamp: " + std::string(strerror(errno)));
+        }
+    }
+#else
+    (void)properties;
+#endif
+}
+
+
 
 
 
@@ -790,4 +1431,17 @@ void thread::SetAffinity(const thread::Properties& properties)
 }
 
 
+// Live thread registry, implements the registry hooks of the thread class
+#include "OSCompatible/registry.hpp"
+// Kernel runtime statistics, implements thread::stats
+#include "OSCompatible/stats.hpp"
+// Performance counters, implements thread::counters
+#include "OSCompatible/perf_counters.hpp"
+// Sampling profiler, implements the sampling hooks of the thread class
+#include "OSCompatible/sampler.hpp"
+// Lifecycle tracer, implements the tracer hooks of the thread class
+#include "OSCompatible/tracer.hpp"
+// Named thread profiles, implements the profile constructors of the thread class
+#include "OSCompatible/profile.hpp"
+
 #endif //__thread__
\ No newline at end of file
@@ -0,0 +1,270 @@
+/**
+ * @file topology.hpp
+ *
+ * @brief CPU topology of the host read from sysfs: online and isolated
+ * (isolcpus/nohz_full) CPUs, SMT siblings and physical packages, plus the
+ * measured core-to-core latency matrix (benchmarks/core_to_core.cpp) to rank
+ * close cores.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __topology__
+#define __topology__
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include "OSCompatible/cpulist.hpp"
+
+
+namespace OSCompatible
+{
+namespace topology
+{
+
+
+/**
+ * @brief Online CPUs (/sys/devices/system/cpu/online), all the
+ * hardware_concurrency CPUs when not available.
+ */
+inline std::vector<bool> onlineCpus()
+{
+    std::vector<bool> cpus = cpulist::read("/sys/devices/system/cpu/online");
+    if (cpus.empty())
+    {
+        cpus.assign(std::max(1u, std::thread::hardware_concurrency()), true);
+    }
+    return cpus;
+}
+
+
+/**
+ * @brief CPUs isolated from the general scheduler (isolcpus) or running
+ * tickless (nohz_full), both are good homes for latency critical threads.
+ */
+inline std::vector<bool> isolatedCpus()
+{
+    // Kernels built with nohz_full support but booted without it print "(null)", treated as no CPU
+    auto readOrEmpty = [](const std::string& path) -> std::vector<bool>
+    {
+        try
+        {
+            return cpulist::read(path);
+        }
+        catch (const std::exception&)
+        {
+            return {};
+        }
+    };
+
+    std::vector<bool> isolated = readOrEmpty("/sys/devices/system/cpu/isolated");
+    std::vector<bool> nohzFull = readOrEmpty("/sys/devices/system/cpu/nohz_full");
+
+    if (nohzFull.size() > isolated.size())
+    {
+        isolated.resize(nohzFull.size(), false);
+    }
+    for (size_t cpu = 0; cpu < nohzFull.size(); ++cpu)
+    {
+        isolated[cpu] = isolated[cpu] || nohzFull[cpu];
+    }
+    return isolated;
+}
+
+
+/**
+ * @brief SMT siblings of a CPU (hardware threads sharing its physical core),
+ * including the CPU itself.
+ */
+inline std::vector<bool> siblings(size_t cpu)
+{
+    std::vector<bool> result = cpulist::read("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                                             "/topology/thread_siblings_list");
+    if (cpulist::count(result) == 0)
+    {
+        result.assign(cpu + 1, false);
+        result[cpu] = true;
+    }
+    return result;
+}
+
+
+/**
+ * @brief Physical package (socket) of a CPU, 0 when unknown.
+ */
+inline int package(size_t cpu)
+{
+    std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id");
+    int id = 0;
+    if (!(file >> id))
+    {
+        return 0;
+    }
+    return id;
+}
+
+
+/**
+ * @brief Physical cores of the given CPUs, each one as the mask of its SMT
+ * siblings (restricted to the given CPUs), ordered by their first CPU.
+ */
+inline std::vector<std::vector<bool>> cores(const std::vector<bool>& cpus)
+{
+    std::vector<std::vector<bool>> result;
+    std::vector<bool> assigned(cpus.size(), false);
+
+    for (size_t cpu = 0; cpu < cpus.size(); ++cpu)
+    {
+        if (!cpus[cpu] || assigned[cpu])
+        {
+            continue;
+        }
+
+        std::vector<bool> core = cpulist::intersect(siblings(cpu), cpus);
+        if (core.size() <= cpu)
+        {
+            core.resize(cpu + 1, false);
+        }
+        core[cpu] = true;
+
+        for (size_t sibling = 0; sibling < core.size(); ++sibling)
+        {
+            if (core[sibling])
+            {
+                assigned[sibling] = true;
+            }
+        }
+        result.push_back(core);
+    }
+    return result;
+}
+
+
+/**
+ * @brief Reads a core-to-core latency matrix in the CSV format of the
+ * core_to_core benchmark: a "cpu,<id>,<id>..." header, then one
+ * "<id>,<ns>,<ns>..." row per CPU, empty cells for pairs not measured.
+ *
+ * @return latency[from][to] in nanoseconds indexed by CPU id, -1 for the
+ * pairs not measured, empty if the file can't be read or is malformed.
+ */
+inline std::vector<std::vector<double>> readLatencyMatrix(const std::string& path)
+{
+    std::vector<std::vector<double>> matrix;
+    std::ifstream file(path);
+    std::string line;
+
+    auto split = [](const std::string& text)
+    {
+        std::vector<std::string> cells;
+        std::istringstream stream(text);
+        std::string cell;
+        while (std::getline(stream, cell, ','))
+        {
+            cells.push_back(cell);
+        }
+        return cells;
+    };
+
+    if (!std::getline(file, line))
+    {
+        return matrix;
+    }
+
+    // A malformed header or cell (not written by the benchmark) reads as no matrix
+    try
+    {
+        std::vector<size_t> columns;
+        std::vector<std::string> header = split(line);
+        for (size_t i = 1; i < header.size(); ++i)
+        {
+            columns.push_back(std::stoul(header[i]));
+        }
+
+        size_t size = columns.empty() ? 0 : *std::max_element(columns.begin(), columns.end()) + 1;
+        matrix.assign(size, std::vector<double>(size, -1.0));
+
+        while (std::getline(file, line))
+        {
+            std::vector<std::string> cells = split(line);
+            if (cells.empty() || cells[0].empty())
+            {
+                continue;
+            }
+
+            size_t from = std::stoul(cells[0]);
+            if (from >= size)
+            {
+                size = from + 1;
+                for (auto& row : matrix)
+                {
+                    row.resize(size, -1.0);
+                }
+                matrix.resize(size, std::vector<double>(size, -1.0));
+            }
+
+            for (size_t i = 1; i < cells.size() && i - 1 < columns.size(); ++i)
+            {
+                if (!cells[i].empty())
+                {
+                    matrix[from][columns[i - 1]] = std::stod(cells[i]);
+                }
+            }
+        }
+    }
+    catch (const std::exception&)
+    {
+        matrix.clear();
+    }
+    return matrix;
+}
+
+
+/**
+ * @brief CPUs ranked from the closest to the farthest from a CPU by measured
+ * latency, @see readLatencyMatrix.
+ *
+ * @param cpu The CPU to rank from.
+ * @param latency Latency matrix, latency[from][to].
+ * @param candidates CPUs to rank, empty for all the measured ones.
+ * @return The measured candidates except cpu itself, closest first.
+ */
+inline std::vector<size_t> closest(size_t cpu, const std::vector<std::vector<double>>& latency,
+                                   const std::vector<bool>& candidates = {})
+{
+    std::vector<size_t> result;
+    if (cpu >= latency.size())
+    {
+        return result;
+    }
+
+    for (size_t other = 0; other < latency[cpu].size(); ++other)
+    {
+        bool candidate = candidates.empty() || (other < candidates.size() && candidates[other]);
+        if (other != cpu && candidate && latency[cpu][other] >= 0.0)
+        {
+            result.push_back(other);
+        }
+    }
+
+    std::stable_sort(result.begin(), result.end(), [&](size_t a, size_t b)
+    {
+        return latency[cpu][a] < latency[cpu][b];
+    });
+    return result;
+}
+
+
+} // namespace topology
+} // namespace OSCompatible
+
+
+#endif //__topology__
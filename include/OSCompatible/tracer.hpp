@@ -0,0 +1,441 @@
+/**
+ * @file tracer.hpp
+ *
+ * @brief Optional lifecycle tracer of the OSCompatible threads, dumped as
+ * Chrome trace events (chrome://tracing, ui.perfetto.dev), to see the
+ * spawn-to-run latency, the time spent applying properties and the join
+ * stalls of startup and fan-out phases.
+ *
+ * Recorded events, with nanosecond timestamps of the steady clock:
+ *  spawn      - the constructor, in the spawning thread
+ *  start      - from the first instruction of the new thread to its body,
+ *               linked to its spawn by a flow arrow
+ *  properties - applying the in-thread properties, inside start
+ *  body       - the thread function
+ *  join       - the join call, in the joining thread
+ *  detach     - instant event, in the detaching thread
+ *
+ * Latency percentiles can be added as counter tracks with counter().
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __tracer__
+#define __tracer__
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/histogram.hpp"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Records the lifecycle events of the threads while enabled.
+ *
+ * Each thread appends to its own buffer, so recording doesn't contend
+ * between threads, disabled tracing costs a relaxed atomic load per event.
+ *
+ * @code
+ * OSCompatible::tracer::enable();
+ * startWorkers();
+ * OSCompatible::tracer::write("startup.json"); // open in ui.perfetto.dev
+ * @endcode
+ */
+class tracer
+{
+public:
+    static constexpr size_t CAPACITY = 4096;    // Events kept per thread, later ones are dropped
+
+    static void enable();
+    static void disable();
+    static bool enabled();
+
+    // Chrome trace event JSON of all the recorded events
+    static std::string dump();
+
+    // Writes dump() to a file
+    static void write(const std::string& path);
+
+    // Drops the recorded events
+    static void clear();
+
+    // Events lost because a thread buffer was full
+    static uint64_t dropped();
+
+    /**
+     * @brief Records the percentiles of a histogram as a counter track
+     * (p50, p90, p99, p99.9 and max series) at the current time.
+     *
+     * @code
+     * OSCompatible::tracer::counter("task duration ns", taskDuration.summary());
+     * @endcode
+     */
+    static void counter(const std::string& name, const histogram::Summary& summary);
+
+private:
+    friend class thread;
+
+    struct Event
+    {
+        const char* name;
+        int64_t begin;      // ns
+        int64_t end;        // ns, equal to begin for instant events
+        uint64_t flow;      // Flow id linking spawn to start, 0 for none
+        char flowPhase;     // 's' (flow start), 'f' (flow end) or 0
+        long target;        // Tid of the joined/detached thread, 0 if none
+    };
+
+    struct Counter
+    {
+        std::string name;
+        int64_t time;       // ns
+        histogram::Summary summary;
+    };
+
+    struct Buffer
+    {
+        std::mutex mutex;   // Taken by the owner and by dump, never contended between workers
+        long tid = 0;
+        std::string name;
+        std::vector<Event> events;
+        std::vector<Counter> counters;
+        uint64_t dropped = 0;
+    };
+
+    struct State
+    {
+        std::atomic<bool> enabled{false};
+        std::atomic<uint64_t> nextFlow{1};
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Buffer>> buffers;
+    };
+
+    static State& GetState();
+    static Buffer& CurrentBuffer();
+    static int64_t Now();
+    static void Record(const Event& event);
+    static std::string Escape(const std::string& text);
+};
+
+
+
+inline tracer::State& tracer::GetState()
+{
+    static State state;
+    return state;
+}
+
+
+inline tracer::Buffer& tracer::CurrentBuffer()
+{
+    thread_local std::shared_ptr<Buffer> buffer;
+
+    if (!buffer)
+    {
+        buffer = std::make_shared<Buffer>();
+        buffer->tid = thread::CurrentTid();
+        buffer->events.reserve(64);
+
+        State& state = GetState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+
+inline int64_t tracer::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+inline void tracer::enable()
+{
+    GetState().enabled.store(true, std::memory_order_relaxed);
+}
+
+
+inline void tracer::disable()
+{
+    GetState().enabled.store(false, std::memory_order_relaxed);
+}
+
+
+inline bool tracer::enabled()
+{
+    return GetState().enabled.load(std::memory_order_relaxed);
+}
+
+
+inline void tracer::Record(const Event& event)
+{
+    Buffer& buffer = CurrentBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+#ifndef _WIN32
+    // The name changes when the properties are applied, keep the latest one
+    char name[16] = {0};
+    if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+    {
+        buffer.name = name;
+    }
+#endif
+
+    if (buffer.events.size() >= CAPACITY)
+    {
+        ++buffer.dropped;
+        return;
+    }
+    buffer.events.push_back(event);
+}
+
+
+inline std::string tracer::Escape(const std::string& text)
+{
+    std::string result;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(static_cast<unsigned char>(c)));
+            result += escaped;
+        }
+        else
+        {
+            result += c;
+        }
+    }
+    return result;
+}
+
+
+inline std::string tracer::dump()
+{
+#ifdef _WIN32
+    const long pid = static_cast<long>(GetCurrentProcessId());
+#else
+    const long pid = static_cast<long>(getpid());
+#endif
+
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    {
+        State& state = GetState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        buffers = state.buffers;
+    }
+
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = false;
+    char line[512];
+
+    auto append = [&](const char* text)
+    {
+        json += first ? ",\n" : "\n";
+        json += text;
+        first = true;
+    };
+
+    for (const auto& buffer : buffers)
+    {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+
+        std::snprintf(line, sizeof(line),
+                      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                      pid, buffer->tid, Escape(buffer->name).c_str());
+        append(line);
+
+        for (const Event& event : buffer->events)
+        {
+            // Chrome trace timestamps are microseconds
+            const double ts = static_cast<double>(event.begin) / 1000.0;
+
+            if (event.end == event.begin && event.flowPhase == 0)
+            {
+                std::snprintf(line, sizeof(line),
+                              "{\"name\":\"%s\",\"cat\":\"thread\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld,\"args\":{\"target\":%ld}}",
+                              event.name, ts, pid, buffer->tid, event.target);
+                append(line);
+                continue;
+            }
+
+            std::snprintf(line, sizeof(line),
+                          "{\"name\":\"%s\",\"cat\":\"thread\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld,\"args\":{\"target\":%ld}}",
+                          event.name, ts, static_cast<double>(event.end - event.begin) / 1000.0, pid, buffer->tid, event.target);
+            append(line);
+
+            if (event.flowPhase != 0)
+            {
+                // Flow arrow from the spawn slice to the start slice of the new thread
+                std::snprintf(line, sizeof(line),
+                              "{\"name\":\"spawn\",\"cat\":\"thread\",\"ph\":\"%c\",\"id\":%llu,%s\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                              event.flowPhase, static_cast<unsigned long long>(event.flow),
+                              event.flowPhase == 'f' ? "\"bp\":\"e\"," : "", ts, pid, buffer->tid);
+                append(line);
+            }
+        }
+
+        for (const Counter& counter : buffer->counters)
+        {
+            std::snprintf(line, sizeof(line),
+                          "\"ph\":\"C\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld,\"args\":{\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p99.9\":%lld,\"max\":%lld}}",
+                          static_cast<double>(counter.time) / 1000.0, pid, buffer->tid,
+                          static_cast<long long>(counter.summary.p50), static_cast<long long>(counter.summary.p90),
+                          static_cast<long long>(counter.summary.p99), static_cast<long long>(counter.summary.p999),
+                          static_cast<long long>(counter.summary.max));
+            append(("{\"name\":\"" + Escape(counter.name) + "\",\"cat\":\"histogram\"," + line).c_str());
+        }
+    }
+
+    json += "\n]}\n";
+    return json;
+}
+
+
+inline void tracer::write(const std::string& path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open trace file " + path + ": " + std::string(strerror(errno)));
+    }
+    file << dump();
+}
+
+
+inline void tracer::clear()
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    for (const auto& buffer : state.buffers)
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        buffer->events.clear();
+        buffer->counters.clear();
+        buffer->dropped = 0;
+    }
+
+    // Buffers of finished threads are referenced only from here
+    std::vector<std::shared_ptr<Buffer>> alive;
+    for (auto& buffer : state.buffers)
+    {
+        if (buffer.use_count() > 1)
+        {
+            alive.push_back(std::move(buffer));
+        }
+    }
+    state.buffers = std::move(alive);
+}
+
+
+inline void tracer::counter(const std::string& name, const histogram::Summary& summary)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    Buffer& buffer = CurrentBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+    if (buffer.counters.size() >= CAPACITY)
+    {
+        ++buffer.dropped;
+        return;
+    }
+    buffer.counters.push_back({name, Now(), summary});
+}
+
+
+inline uint64_t tracer::dropped()
+{
+    State& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    uint64_t total = 0;
+    for (const auto& buffer : state.buffers)
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        total += buffer->dropped;
+    }
+    return total;
+}
+
+
+
+// Lifecycle tracer hooks of the thread class
+
+inline int64_t thread::TraceBegin()
+{
+    return tracer::enabled() ? tracer::Now() : 0;
+}
+
+
+inline uint64_t thread::TraceFlow()
+{
+    return tracer::enabled() ? tracer::GetState().nextFlow.fetch_add(1, std::memory_order_relaxed) : 0;
+}
+
+
+inline void thread::TraceEnd(const char* event, int64_t begin, uint64_t flow, long target)
+{
+    if (begin == 0 || !tracer::enabled())
+    {
+        return;
+    }
+
+    // A flow starts at the spawn and ends at the start of the new thread
+    char flowPhase = 0;
+    if (flow != 0)
+    {
+        flowPhase = std::strcmp(event, "spawn") == 0 ? 's' : 'f';
+    }
+    tracer::Record({event, begin, tracer::Now(), flow, flowPhase, target});
+}
+
+
+inline void thread::TraceInstant(const char* event, long target)
+{
+    if (!tracer::enabled())
+    {
+        return;
+    }
+
+    const int64_t now = tracer::Now();
+    tracer::Record({event, now, now, 0, 0, target});
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__tracer__
@@ -0,0 +1,387 @@
+/**
+ * @file watchdog.hpp
+ *
+ * @brief Heartbeat watchdog for threads that stall (block or stop making
+ * progress) or overrun their CPU budget (spin), so they are noticed when it
+ * happens instead of through downstream latency.
+ *
+ * Workers feed the watchdog with a relaxed increment of their own cache line,
+ * the watchdog thread compares the counters between its checks and reads the
+ * CPU time of the watched threads, and fires a callback with the thread
+ * statistics and optionally its stack.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __watchdog__
+#define __watchdog__
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/registry.hpp"
+#include "OSCompatible/stats.hpp"
+#include "OSCompatible/sampler.hpp"
+
+
+namespace OSCompatible
+{
+
+class watchdog_feed;
+
+
+/**
+ * @brief Watches the threads that registered with watch() from a background
+ * thread.
+ *
+ * @code
+ * OSCompatible::watchdog dog([](const OSCompatible::watchdog::Event& event)
+ * {
+ *     log(event.name, event.kind == OSCompatible::watchdog::Kind::stalled ? "stalled" : "overrun", event.stack);
+ * });
+ *
+ * OSCompatible::thread worker(rtProperties, [&dog]()
+ * {
+ *     OSCompatible::watchdog_feed feed = dog.watch({std::chrono::milliseconds(50), 0.5, true});
+ *     while (running)
+ *     {
+ *         feed.beat();
+ *         step();
+ *     }
+ * });
+ * @endcode
+ */
+class watchdog
+{
+public:
+    enum class Kind
+    {
+        stalled,    // No heartbeat for longer than the timeout
+        overrun     // CPU usage above the budget over a check interval
+    };
+
+    struct Options
+    {
+        std::chrono::milliseconds timeout{100};    // Missed heartbeat after this long without a beat, 0 disables
+        double cpuBudget = 0.0;                     // Maximum share of one CPU over a check interval (0, 1], 0 disables
+        bool sampleStack = false;                   // Capture the stack of the thread for the event
+    };
+
+    struct Event
+    {
+        Kind kind;
+        std::string name;
+        long tid;
+        thread::Stats stats;                        // Statistics of the thread when detected
+        std::chrono::nanoseconds sinceBeat;         // Time since the last heartbeat
+        double cpuUsage;                            // Share of one CPU since the previous measure
+        std::string stack;                          // Folded stack "outer;...;leaf" if sampleStack, @see sampler::stack
+    };
+
+    typedef std::function<void(const Event&)> Callback;
+
+    /**
+     * @brief Starts the watchdog thread.
+     *
+     * @param callback Called from the watchdog thread, once per stall or
+     * overrun (again only after the thread recovered).
+     * @param interval Period of the checks.
+     */
+    explicit watchdog(Callback callback, std::chrono::milliseconds interval = std::chrono::milliseconds(10));
+
+    // Stops the watchdog thread
+    ~watchdog();
+
+    watchdog(const watchdog&) = delete;
+    watchdog& operator=(const watchdog&) = delete;
+
+    /**
+     * @brief Watches the calling thread until the returned feed is destroyed.
+     *
+     * @param options Timeout, CPU budget and stack sampling of the thread.
+     * @param name Name of the thread in the events, empty for the thread name.
+     */
+    watchdog_feed watch(const Options& options, const std::string& name = "");
+
+private:
+    friend class watchdog_feed;
+
+    struct alignas(64) Watched
+    {
+        std::atomic<uint64_t> beats{0};     // Written by the watched thread only
+        std::atomic<bool> active{true};
+        long tid = 0;
+        std::string name;
+        Options options;
+
+        // Watchdog thread state
+        uint64_t lastBeats = 0;
+        std::chrono::steady_clock::time_point lastBeat;
+        uint64_t lastCpuNs = 0;
+        std::chrono::steady_clock::time_point lastCheck;
+        bool stalled = false;
+        bool overrun = false;
+    };
+
+    void Run();
+
+    // One check of the watched threads, @return number of fired events
+    size_t Check();
+    Event MakeEvent(Kind kind, const Watched& watched, std::chrono::steady_clock::time_point now,
+                    const thread::Stats& stats, double cpuUsage) const;
+
+    Callback m_callback;
+    std::chrono::milliseconds m_interval;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+    std::vector<std::shared_ptr<Watched>> m_watched;
+    std::unique_ptr<thread> m_thread;
+};
+
+
+/**
+ * @brief Heartbeat of a watched thread, stops the watching when destroyed.
+ */
+class watchdog_feed
+{
+public:
+    watchdog_feed(watchdog_feed&& other) noexcept = default;
+    watchdog_feed& operator=(watchdog_feed&& other) noexcept;
+    ~watchdog_feed();
+
+    watchdog_feed(const watchdog_feed&) = delete;
+    watchdog_feed& operator=(const watchdog_feed&) = delete;
+
+    // A relaxed increment of the thread's own cache line, no clock read.
+    // A no-op after release() or on a moved-from feed.
+    void beat()
+    {
+        if (m_watched == nullptr)
+            return;
+        m_watched->beats.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Stops watching the thread (the next check forgets it)
+    void release();
+
+private:
+    friend class watchdog;
+
+    explicit watchdog_feed(std::shared_ptr<watchdog::Watched> watched);
+
+    std::shared_ptr<watchdog::Watched> m_watched;
+};
+
+
+
+inline watchdog::watchdog(Callback callback, std::chrono::milliseconds interval)
+    :
+    m_callback(std::move(callback)),
+    m_interval(interval),
+    m_mutex(),
+    m_cv(),
+    m_stop(false),
+    m_watched(),
+    m_thread()
+{
+    m_thread = std::make_unique<thread>(&watchdog::Run, this);
+}
+
+
+inline watchdog::~watchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+
+    if (m_thread && m_thread->joinable())
+    {
+        m_thread->join();
+    }
+}
+
+
+inline watchdog_feed watchdog::watch(const Options& options, const std::string& name)
+{
+    auto watched = std::make_shared<Watched>();
+    watched->tid = registry::currentTid();
+    watched->options = options;
+    watched->name = name;
+#ifndef _WIN32
+    if (watched->name.empty())
+    {
+        char current[16] = {0};
+        pthread_getname_np(pthread_self(), current, sizeof(current));
+        watched->name = current;
+    }
+#endif
+    watched->lastBeat = std::chrono::steady_clock::now();
+    watched->lastCheck = watched->lastBeat;
+    watched->lastCpuNs = stats::self().cpuTimeNs;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_watched.push_back(watched);
+    }
+    return watchdog_feed(std::move(watched));
+}
+
+
+inline void watchdog::Run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_cv.wait_for(lock, m_interval, [this]() { return m_stop; }))
+    {
+        lock.unlock();
+        Check();
+        lock.lock();
+    }
+}
+
+
+inline watchdog::Event watchdog::MakeEvent(Kind kind, const Watched& watched, std::chrono::steady_clock::time_point now,
+                                           const thread::Stats& stats, double cpuUsage) const
+{
+    Event event;
+    event.kind = kind;
+    event.name = watched.name;
+    event.tid = watched.tid;
+    event.stats = stats;
+    event.sinceBeat = std::chrono::duration_cast<std::chrono::nanoseconds>(now - watched.lastBeat);
+    event.cpuUsage = cpuUsage;
+    if (watched.options.sampleStack)
+    {
+        event.stack = sampler::stack(watched.tid);
+    }
+    return event;
+}
+
+
+inline size_t watchdog::Check()
+{
+    std::vector<std::shared_ptr<Watched>> watched;
+    {
+        // Forget the released feeds, check the others outside of the lock
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::vector<std::shared_ptr<Watched>> active;
+        for (auto& entry : m_watched)
+        {
+            if (entry->active.load(std::memory_order_acquire))
+            {
+                active.push_back(std::move(entry));
+            }
+        }
+        m_watched = std::move(active);
+        watched = m_watched;
+    }
+
+    std::vector<Event> events;
+    const auto now = std::chrono::steady_clock::now();
+
+    for (auto& entry : watched)
+    {
+        Watched& w = *entry;
+
+        const uint64_t beats = w.beats.load(std::memory_order_relaxed);
+        if (beats != w.lastBeats)
+        {
+            w.lastBeats = beats;
+            w.lastBeat = now;
+            w.stalled = false;
+        }
+
+        const bool stalled = w.options.timeout.count() > 0 && now - w.lastBeat > w.options.timeout;
+
+        double cpuUsage = 0.0;
+        thread::Stats threadStats = {0, 0, 0, 0, 0, 0, -1, 0};
+        if (w.options.cpuBudget > 0.0 || (stalled && !w.stalled))
+        {
+            threadStats = stats::read(w.tid);
+
+            const auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(now - w.lastCheck).count();
+            if (wall > 0 && threadStats.cpuTimeNs >= w.lastCpuNs)
+            {
+                cpuUsage = static_cast<double>(threadStats.cpuTimeNs - w.lastCpuNs) / static_cast<double>(wall);
+            }
+            w.lastCpuNs = threadStats.cpuTimeNs;
+            w.lastCheck = now;
+        }
+
+        if (stalled && !w.stalled)
+        {
+            w.stalled = true;
+            events.push_back(MakeEvent(Kind::stalled, w, now, threadStats, cpuUsage));
+        }
+
+        if (w.options.cpuBudget > 0.0)
+        {
+            const bool overrun = cpuUsage > w.options.cpuBudget;
+            if (overrun && !w.overrun)
+            {
+                events.push_back(MakeEvent(Kind::overrun, w, now, threadStats, cpuUsage));
+            }
+            w.overrun = overrun;
+        }
+    }
+
+    for (const Event& event : events)
+    {
+        m_callback(event);
+    }
+    return events.size();
+}
+
+
+
+inline watchdog_feed::watchdog_feed(std::shared_ptr<watchdog::Watched> watched)
+    :
+    m_watched(std::move(watched))
+{ }
+
+
+inline watchdog_feed& watchdog_feed::operator=(watchdog_feed&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_watched = std::move(other.m_watched);
+    }
+    return *this;
+}
+
+
+inline watchdog_feed::~watchdog_feed()
+{
+    release();
+}
+
+
+inline void watchdog_feed::release()
+{
+    if (m_watched)
+    {
+        m_watched->active.store(false, std::memory_order_release);
+        m_watched.reset();
+    }
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__watchdog__
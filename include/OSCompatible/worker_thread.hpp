@@ -0,0 +1,157 @@
+/**
+ * @file worker_thread.hpp
+ *
+ * @brief Polling worker loop on an OSCompatible thread: calls a poll function
+ * until stopped and waits between empty polls with the idle strategy given as
+ * a template parameter (@see idle_strategy.hpp), so the hot path has no
+ * virtual call.
+ *
+ * @author Rostik
+ * @version 1.3
+ * @date 2024-07-27
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef __worker_thread__
+#define __worker_thread__
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+#include "OSCompatible/thread.hpp"
+#include "OSCompatible/idle_strategy.hpp"
+
+
+namespace OSCompatible
+{
+
+
+/**
+ * @brief Runs poll() in a loop on a thread created with the given properties,
+ * poll returns the work it did (0 when it found nothing to do).
+ *
+ * @code
+ * // Latency-critical pinned consumer
+ * OSCompatible::worker_thread<OSCompatible::idle::busy_spin> consumer(pinnedProps, [&]() { return ring.drain(handle); });
+ *
+ * // Background worker, no CPU burnt while the queue is empty
+ * OSCompatible::idle::wakeup_signal wakeup;
+ * OSCompatible::worker_thread<OSCompatible::idle::spin_park> flusher(props, [&]() { return queue.drain(flush); },
+ *                                                                  OSCompatible::idle::spin_park(wakeup));
+ * @endcode
+ */
+template <typename IdleStrategy>
+class worker_thread
+{
+public:
+    /**
+     * @brief Starts the loop.
+     *
+     * @throw std::runtime_error if the thread can't be created with the properties.
+     */
+    template <typename Poll>
+    worker_thread(const thread::Properties& properties, Poll&& poll, IdleStrategy idle = IdleStrategy());
+
+    // Stops the loop and joins the thread
+    ~worker_thread();
+
+    worker_thread(const worker_thread&) = delete;
+    worker_thread& operator=(const worker_thread&) = delete;
+
+    // Stops the loop after the running poll, wakes the idle strategy and joins the thread
+    void stop();
+
+    // Polls run so far
+    uint64_t polls() const;
+
+    // Polls that found no work
+    uint64_t idlePolls() const;
+
+private:
+    void Run();
+
+    std::function<size_t()> m_poll;
+    IdleStrategy m_idle;
+    std::atomic<bool> m_stop;
+    std::atomic<uint64_t> m_polls;
+    std::atomic<uint64_t> m_idlePolls;
+    std::unique_ptr<thread> m_thread;
+};
+
+
+
+template <typename IdleStrategy>
+template <typename Poll>
+worker_thread<IdleStrategy>::worker_thread(const thread::Properties& properties, Poll&& poll, IdleStrategy idle)
+    :
+    m_poll(std::forward<Poll>(poll)),
+    m_idle(std::move(idle)),
+    m_stop(false),
+    m_polls(0),
+    m_idlePolls(0),
+    m_thread()
+{
+    m_thread = std::make_unique<thread>(properties, &worker_thread::Run, this);
+}
+
+
+template <typename IdleStrategy>
+worker_thread<IdleStrategy>::~worker_thread()
+{
+    stop();
+}
+
+
+template <typename IdleStrategy>
+void worker_thread<IdleStrategy>::stop()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+
+    if (m_thread && m_thread->joinable())
+    {
+        m_idle.wake();
+        m_thread->join();
+    }
+}
+
+
+template <typename IdleStrategy>
+uint64_t worker_thread<IdleStrategy>::polls() const
+{
+    return m_polls.load(std::memory_order_relaxed);
+}
+
+
+template <typename IdleStrategy>
+uint64_t worker_thread<IdleStrategy>::idlePolls() const
+{
+    return m_idlePolls.load(std::memory_order_relaxed);
+}
+
+
+template <typename IdleStrategy>
+void worker_thread<IdleStrategy>::Run()
+{
+    // Counted locally, published with relaxed stores only the owner writes
+    uint64_t polls = 0;
+    uint64_t idlePolls = 0;
+
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        const size_t work = m_poll();
+
+        ++polls;
+        idlePolls += work == 0 ? 1 : 0;
+        m_polls.store(polls, std::memory_order_relaxed);
+        m_idlePolls.store(idlePolls, std::memory_order_relaxed);
+
+        m_idle.idle(work);
+    }
+}
+
+
+} // namespace OSCompatible
+
+
+#endif //__worker_thread__
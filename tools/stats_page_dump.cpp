@@ -0,0 +1,68 @@
+/**
+ * @file stats_page_dump.cpp
+ * @brief Dumps the per-thread counters of a stats page (/dev/shm/<name>)
+ * published by an OSCompatible process, once or repeatedly.
+ *
+ * Usage: OSCompatible_stats_page_dump <name> [interval_ms]
+ */
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+#include "OSCompatible.h"
+
+
+static void dump(const OSCompatible::stats_page& page)
+{
+    const int64_t now = OSCompatible::stats_page::now();
+
+    std::cout << "pid " << page.header().pid << ", " << page.header().capacity << " slots" << std::endl;
+    std::cout << std::left << std::setw(8) << "tid" << std::setw(17) << "name"
+              << std::right << std::setw(14) << "tasks" << std::setw(12) << "wakeups"
+              << std::setw(10) << "queue" << std::setw(14) << "cpu ms" << std::setw(16) << "heartbeat ms" << std::endl;
+
+    for (const auto& entry : page.snapshot())
+    {
+        std::cout << std::left << std::setw(8) << entry.tid << std::setw(17) << entry.name
+                  << std::right << std::setw(14) << entry.tasks << std::setw(12) << entry.wakeups
+                  << std::setw(10) << entry.queueDepth
+                  << std::setw(14) << std::fixed << std::setprecision(1) << static_cast<double>(entry.cpuTimeNs) / 1e6
+                  << std::setw(16) << static_cast<double>(now - entry.heartbeatNs) / 1e6
+                  << (entry.torn ? "  torn (update never finished)" : "") << std::endl;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <name> [interval_ms]" << std::endl;
+        return 1;
+    }
+
+    const long interval = argc > 2 ? std::atol(argv[2]) : 0;
+
+    try
+    {
+        auto page = OSCompatible::stats_page::open(argv[1]);
+
+        dump(*page);
+        while (interval > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+            std::cout << std::endl;
+            dump(*page);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}